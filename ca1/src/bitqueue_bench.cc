@@ -0,0 +1,73 @@
+// bitqueue_bench.cc
+// This file contains a micro-benchmark for the BitQueue history register
+// in tage.h.  It reports the cost of a push and of folding the history
+// with get_compressed() for the history lengths and widths Tage uses,
+// after checking every fold against a bit-at-a-time reference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <chrono>
+
+#include "tage.h"
+
+#define PUSHES		(1 << 24)
+#define FOLDS		(1 << 20)
+#define HISTORY_LENGTH	1024
+
+// fold the history one bit at a time; the definition get_compressed() must match
+
+static uint32_t reference_fold (BitQueue & q, size_t in_bits, size_t out_bits) {
+	uint32_t r = 0;
+	for (size_t i=0; i<in_bits; i++)
+		r ^= q.slice (i, i) << (i % out_bits);
+	return r;
+}
+
+static double ns_since (std::chrono::steady_clock::time_point start, long long int n) {
+	std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now () - start;
+	return d.count () / n;
+}
+
+int main (void) {
+	BitQueue q (HISTORY_LENGTH);
+	unsigned int lfsr = 0xace1u, sink = 0;
+
+#ifdef __AVX2__
+	printf ("BitQueue(%d), AVX2 folds\n", HISTORY_LENGTH);
+#else
+	printf ("BitQueue(%d), scalar folds\n", HISTORY_LENGTH);
+#endif
+
+	// push a pseudo-random outcome stream
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (int i=0; i<PUSHES; i++) {
+		lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xb400u);
+		q.push (lfsr & 1);
+	}
+	printf ("push                 %8.3f ns\n", ns_since (start, PUSHES));
+
+	// fold at the Tage history lengths and widths, plus the whole buffer
+
+	size_t lengths[] = { 5, 14, 37, 100, 273, HISTORY_LENGTH };
+	size_t widths[] = { 9, 12 };
+	for (size_t w=0; w<sizeof (widths) / sizeof (widths[0]); w++) {
+		for (size_t l=0; l<sizeof (lengths) / sizeof (lengths[0]); l++) {
+			size_t in_bits = lengths[l], out_bits = widths[w];
+			for (int i=0; i<64; i++) {
+				q.push (i % 3 == 0);
+				assert (q.get_compressed (in_bits, out_bits) == reference_fold (q, in_bits, out_bits));
+			}
+			start = std::chrono::steady_clock::now ();
+			for (int i=0; i<FOLDS; i++)
+				sink += q.get_compressed (in_bits, out_bits);
+			printf ("fold %4zu -> %2zu bits %8.3f ns\n", in_bits, out_bits, ns_since (start, FOLDS));
+		}
+	}
+
+	// keep the folds from being optimized away
+
+	fprintf (stderr, "%u\n", sink);
+	return 0;
+}
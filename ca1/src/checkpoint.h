@@ -0,0 +1,105 @@
+// checkpoint.h
+// This file contains checkpoints of a simulation: the position in the
+// trace and, for every predictor being simulated, its preset, its miss
+// counts so far and its complete state as written by its save method.
+// A run can write a checkpoint every so many traces and a later run can
+// pick up from any of them, e.g. to try a change that only matters late
+// in a trace, or to simulate the pieces between checkpoints at once.
+//
+// The file is a checkpoint_header followed, for every predictor, by a
+// checkpoint_run and then the bytes its save method wrote.
+
+#include <string.h>
+#include <vector>
+
+#define CHECKPOINT_MAGIC	"CBP2CKP"
+#define CHECKPOINT_VERSION	2
+
+struct checkpoint_header {
+	char magic[8];			// CHECKPOINT_MAGIC
+	unsigned int version;		// CHECKPOINT_VERSION
+	unsigned int nruns;		// number of predictors
+	unsigned long long position;	// number of traces simulated
+};
+
+struct checkpoint_run {
+	char name[32];			// preset
+	long long int tmiss, dmiss;
+	unsigned long long size;	// bytes of predictor state that follow
+};
+
+// write a checkpoint of runs at position to fname; false on failure
+
+bool save_checkpoint (const char *fname, unsigned long long position, std::vector<predictor_run> & runs) {
+	FILE *f = fopen (fname, "wb");
+	if (!f) {
+		perror (fname);
+		return false;
+	}
+	checkpoint_header h;
+	memset (&h, 0, sizeof (h));
+	strcpy (h.magic, CHECKPOINT_MAGIC);
+	h.version = CHECKPOINT_VERSION;
+	h.nruns = runs.size ();
+	h.position = position;
+	bool ok = fwrite (&h, sizeof (h), 1, f) == 1;
+	for (size_t i=0; i<runs.size () && ok; i++) {
+		checkpoint_run r;
+		memset (&r, 0, sizeof (r));
+		strncpy (r.name, runs[i].name, sizeof (r.name) - 1);
+		r.tmiss = runs[i].tmiss;
+		r.dmiss = runs[i].dmiss;
+
+		// the size is only known once the state is written
+
+		long start = ftell (f);
+		ok = fwrite (&r, sizeof (r), 1, f) == 1 && runs[i].p->save (f);
+		long end = ftell (f);
+		r.size = end - start - sizeof (r);
+		ok = ok && fseek (f, start, SEEK_SET) == 0
+			&& fwrite (&r, sizeof (r), 1, f) == 1
+			&& fseek (f, end, SEEK_SET) == 0;
+		if (!ok) fprintf (stderr, "%s: can't save preset \"%s\"\n", fname, runs[i].name);
+	}
+	if (fclose (f) != 0) ok = false;
+	if (!ok) remove (fname);
+	return ok;
+}
+
+// read the checkpoint in fname, building a predictor for every preset
+// in it into runs (keeping statistics if stats is true) and setting
+// position; false on failure
+
+bool load_checkpoint (const char *fname, unsigned long long & position, std::vector<predictor_run> & runs, bool stats = false) {
+	FILE *f = fopen (fname, "rb");
+	if (!f) {
+		perror (fname);
+		return false;
+	}
+	checkpoint_header h;
+	bool ok = fread (&h, sizeof (h), 1, f) == 1
+		&& memcmp (h.magic, CHECKPOINT_MAGIC, sizeof (h.magic)) == 0
+		&& h.version == CHECKPOINT_VERSION;
+	if (!ok) fprintf (stderr, "%s: not a checkpoint\n", fname);
+	for (unsigned int i=0; i<h.nruns && ok; i++) {
+		checkpoint_run r;
+		ok = fread (&r, sizeof (r), 1, f) == 1;
+		if (!ok) break;
+		r.name[sizeof (r.name) - 1] = 0;
+		const predictor_preset *preset = find_preset (r.name);
+		branch_predictor *p = preset ? preset->make (stats) : NULL;
+		long start = ftell (f);
+		ok = p && p->restore (f) && ftell (f) - start == (long) r.size;
+		if (!ok) {
+			fprintf (stderr, "%s: can't restore preset \"%s\"\n", fname, r.name);
+			delete p;
+			break;
+		}
+		runs.push_back (predictor_run (preset->name, p));
+		runs.back ().tmiss = r.tmiss;
+		runs.back ().dmiss = r.dmiss;
+	}
+	fclose (f);
+	position = h.position;
+	return ok;
+}
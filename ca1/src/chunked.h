@@ -0,0 +1,45 @@
+// chunked.h
+// This file describes the chunked trace container written by "ct -c -n"
+// (see compress/) and read by trace.cc.  An ordinary CBP-2 trace is one
+// pre-processed stream that has to be decoded from its first byte.  In
+// a chunked trace the stream is cut every so many traces, and each chunk
+// is pre-processed starting from an empty remember table and return
+// address stack and then compressed with bzip2 on its own, so any chunk
+// can be decoded without the ones before it.  An index of the chunks at
+// the end of the file lets a reader seek straight to any trace.
+//
+// The file is laid out as:
+//
+//	chunked_header
+//	the compressed chunks, one after another
+//	chunk_entry for every chunk
+//	chunked_footer
+
+#define CHUNKED_MAGIC	"CBP2CHK"
+#define CHUNKED_VERSION	1
+
+struct chunked_header {
+	char magic[8];			// CHUNKED_MAGIC
+	unsigned int version;		// CHUNKED_VERSION
+	unsigned int unused;
+};
+
+// where to find one chunk and which traces it holds
+
+struct chunk_entry {
+	unsigned long long offset;	// file offset of the compressed chunk
+	unsigned long long first;	// index of the first trace in the chunk
+	unsigned int count;		// number of traces in the chunk
+	unsigned int packed;		// size of the compressed chunk
+	unsigned int raw;		// size of the pre-processed chunk
+	unsigned int unused;
+};
+
+struct chunked_footer {
+	unsigned long long index;	// file offset of the first chunk_entry
+	unsigned long long nchunks;	// number of chunks
+	unsigned long long ntraces;	// number of traces in all the chunks
+	unsigned int max_raw;		// largest pre-processed chunk
+	unsigned int version;		// CHUNKED_VERSION
+	char magic[8];			// CHUNKED_MAGIC
+};
@@ -0,0 +1,216 @@
+// chunk.cc
+// This file writes chunked traces (see ../chunked.h).  It reads a trace
+// in the original 9 byte format, cuts it into chunks of so many traces,
+// and pre-processes and bzip2-compresses several chunks at once on
+// their own threads.  Each chunk is pre-processed by the same predictor
+// as in trace.cc, starting from an empty table and return address stack.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bzlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "../chunked.h"
+
+// one trace in the original format
+
+struct raw_trace {
+	unsigned char code;
+	unsigned int address, target;
+};
+
+// the pre-processing state for one chunk
+
+struct chunk_coder {
+	remember rtab[N_REMEMBER][ASSOC];
+	unsigned int ras[RAS_SIZE];
+	int ras_top;
+	unsigned int now;
+	remember last_one;
+
+	void reset (void) {
+		memset (rtab, 0, sizeof (rtab));
+		ras_top = RAS_SIZE;
+		now = 0;
+		last_one = remember ();
+	}
+
+	void push_ras (unsigned int a) {
+		if (ras_top) ras[--ras_top] = a;
+	}
+
+	unsigned int pop_ras (void) {
+		if (ras_top < RAS_SIZE) return ras[ras_top++];
+		return 0;
+	}
+
+	// append the pre-processed form of t to out; this is the compressing
+	// half of read_trace in trace.cc
+
+	void encode (raw_trace & t, std::string & out) {
+		remember r (t.code, t.address, t.target, true);
+		remember *p = &rtab[last_one.target & (N_REMEMBER-1)][0];
+		bool ras_correct = false, ras_offby2 = false, ras_offby3 = false;
+		if (t.code == 0x70) {
+			unsigned int popd = pop_ras ();
+			ras_correct = popd == t.target;
+			if (!ras_correct) {
+				if (t.target == popd + 2) {
+					ras_correct = true;
+					ras_offby2 = true;
+				} else if (t.target == popd - 3) {
+					ras_correct = true;
+					ras_offby3 = true;
+				}
+			}
+			if (!ras_correct) ras_top = RAS_SIZE;
+		}
+		int index = -1;
+		for (int i=0; i<ASSOC; i++)
+			if (r.equal (&p[i], ras_correct)) {
+				index = i;
+				break;
+			}
+		if (index != -1) {
+			p[index].lru_time = now++;
+			if (ras_offby2) out += (char) 0x82;
+			else if (ras_offby3) out += (char) 0x83;
+			out += (char) (ras_correct ? index + ASSOC : index);
+		} else {
+			int lru = 0;
+			for (int i=1; i<ASSOC; i++)
+				if (p[i].lru_time < p[lru].lru_time) lru = i;
+			p[lru] = r;
+			p[lru].lru_time = now++;
+			out += (char) t.code;
+			for (int i=0; i<32; i+=8) out += (char) (t.address >> i);
+			for (int i=0; i<32; i+=8) out += (char) (t.target >> i);
+		}
+		last_one = r;
+		if (t.code >> 4 == 5) push_ras (t.address + 5);
+		else if (t.code >> 4 == 6) push_ras (t.address + 2);
+	}
+};
+
+// a chunk on its way through a thread
+
+struct chunk_job {
+	std::vector<raw_trace> traces;
+	std::string raw;
+	std::vector<char> packed;
+	chunk_coder *coder;
+};
+
+static void compress_chunk (chunk_job *j) {
+	j->coder->reset ();
+	j->raw.clear ();
+	for (size_t i=0; i<j->traces.size (); i++)
+		j->coder->encode (j->traces[i], j->raw);
+
+	// bzip2's documented bound on the size of its output
+
+	unsigned int n = j->raw.size () + j->raw.size () / 100 + 600;
+	j->packed.resize (n);
+	int err = BZ2_bzBuffToBuffCompress (&j->packed[0], &n, &j->raw[0], j->raw.size (), 9, 0, 0);
+	if (err != BZ_OK) {
+		fprintf (stderr, "bzip2 error %d\n", err);
+		exit (1);
+	}
+	j->packed.resize (n);
+}
+
+// read one trace in the original format; false at the end of the file
+
+static bool read_raw (raw_trace & t) {
+	unsigned char c = read_byte ();
+	if (end_of_file) return false;
+	if (c >> 4 < 1 || c >> 4 > 7) {
+		fprintf (stderr, "unexpected code 0x%02x; chunked traces hold only branches\n", c);
+		exit (1);
+	}
+	t.code = c;
+	t.address = read_uint ();
+	t.target = read_uint ();
+	return true;
+}
+
+void write_chunked (char *fname, FILE *out, int per_chunk, int nthreads) {
+	std::vector<chunk_job> jobs (nthreads);
+	std::vector<chunk_entry> index;
+	unsigned long long offset = 0, ntraces = 0;
+	unsigned int max_raw = 0;
+	bool more = true;
+
+	chunked_header h;
+	memset (&h, 0, sizeof (h));
+	strcpy (h.magic, CHUNKED_MAGIC);
+	h.version = CHUNKED_VERSION;
+	fwrite (&h, sizeof (h), 1, out);
+	offset += sizeof (h);
+
+	init_trace (fname);
+	for (int i=0; i<nthreads; i++) jobs[i].coder = new chunk_coder;
+	while (more) {
+
+		// read as many chunks as there are threads
+
+		int njobs;
+		for (njobs=0; njobs<nthreads && more; njobs++) {
+			std::vector<raw_trace> & v = jobs[njobs].traces;
+			v.resize (per_chunk);
+			int n = 0;
+			while (n < per_chunk && (more = read_raw (v[n]))) n++;
+			v.resize (n);
+			if (!n) break;
+		}
+
+		// compress them at once
+
+		std::vector<std::thread> pool;
+		for (int i=0; i<njobs; i++)
+			pool.push_back (std::thread (compress_chunk, &jobs[i]));
+		for (int i=0; i<njobs; i++)
+			pool[i].join ();
+
+		// and write them out in order
+
+		for (int i=0; i<njobs; i++) {
+			chunk_job & j = jobs[i];
+			chunk_entry e;
+			memset (&e, 0, sizeof (e));
+			e.offset = offset;
+			e.first = ntraces;
+			e.count = j.traces.size ();
+			e.packed = j.packed.size ();
+			e.raw = j.raw.size ();
+			fwrite (&j.packed[0], 1, e.packed, out);
+			index.push_back (e);
+			offset += e.packed;
+			ntraces += e.count;
+			if (e.raw > max_raw) max_raw = e.raw;
+			fprintf (stderr, "chunk %zu: %u traces, %u bytes, %u compressed\n", index.size () - 1, e.count, e.raw, e.packed);
+		}
+	}
+	end_trace ();
+	for (int i=0; i<nthreads; i++) delete jobs[i].coder;
+
+	// the index and the footer that finds it
+
+	chunked_footer f;
+	memset (&f, 0, sizeof (f));
+	f.index = offset;
+	f.nchunks = index.size ();
+	f.ntraces = ntraces;
+	f.max_raw = max_raw;
+	f.version = CHUNKED_VERSION;
+	strcpy (f.magic, CHUNKED_MAGIC);
+	if (!index.empty ()) fwrite (&index[0], sizeof (chunk_entry), index.size (), out);
+	fwrite (&f, sizeof (f), 1, out);
+	fflush (out);
+	fprintf (stderr, "%llu traces in %zu chunks\n", ntraces, index.size ());
+}
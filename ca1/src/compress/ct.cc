@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <zlib.h>
 #include <map>
+#include <thread>
 
 #include "branch.h"
 #include "trace.h"
@@ -11,8 +13,11 @@ bool compressing = false;
 
 int main (int argc, char *argv[]) {
 	long long int ntraces = 0;
+	int per_chunk = 0, nthreads = std::thread::hardware_concurrency ();
+	int first = 2;
 	if (argc < 3) {
 		fprintf (stderr, "Usage: %s [ -d | -c ] <filename>.gz\n", argv[0]);
+		fprintf (stderr, "       %s -c -n <traces-per-chunk> [ -j <threads> ] <filename>\n", argv[0]);
 		exit (1);
 	}
 	if (strcmp (argv[1], "-c") == 0) {
@@ -23,7 +28,27 @@ int main (int argc, char *argv[]) {
 		fprintf (stderr, "Usage: %s [ -d | -c ] <filename>.gz\n", argv[0]);
 		exit (1);
 	}
-	for (int i=2; i<argc; i++) {
+
+	// -c -n writes a chunked trace (see ../chunked.h) to standard output
+	// from one trace in the original format
+
+	for (; compressing && first+1 < argc; first += 2) {
+		if (strcmp (argv[first], "-n") == 0)
+			per_chunk = atoi (argv[first+1]);
+		else if (strcmp (argv[first], "-j") == 0)
+			nthreads = atoi (argv[first+1]);
+		else
+			break;
+	}
+	if (per_chunk > 0) {
+		if (first != argc - 1) {
+			fprintf (stderr, "Usage: %s -c -n <traces-per-chunk> [ -j <threads> ] <filename>\n", argv[0]);
+			exit (1);
+		}
+		write_chunked (argv[first], stdout, per_chunk, nthreads < 1 ? 1 : nthreads);
+		exit (0);
+	}
+	for (int i=first; i<argc; i++) {
 		fprintf (stderr, "reading \"%s\"\n", argv[i]);
 		fflush (stderr);
 		init_trace (argv[i]);
@@ -46,40 +46,8 @@ unsigned int read_uint (void) {
 	return x0 | (x1 << 8) | (x2 << 16) | (x3 << 24);
 }
 
-struct remember {
-	bool taken;
-	unsigned char code;
-	unsigned int address, target;
-	unsigned int lru_time;
-
-	remember (void) {
-		code = 0;
-		address = 0;
-		target = 0;
-		taken = 0;
-		lru_time = 0;
-	}
-
-	remember (unsigned char c, unsigned int a, unsigned int t, bool ta) {
-		code = c;
-		address = a;
-		target = t;
-		taken = ta;
-	}
-
-	bool equal (remember *r, bool ignore_target) {
-		return
-		   r->code == code
-		&& r->taken == taken
-		&& r->address == address 
-		&& (ignore_target || r->target == target);
-	}
-};
-
 // a return address stack
 
-#define RAS_SIZE	100
-
 unsigned int ras[RAS_SIZE];
 int ras_top = 100;
 
@@ -96,9 +64,6 @@ unsigned int pop_ras (void) {
 	return 0;
 }
 
-#define N_REMEMBER	(1<<16)
-#define ASSOC		8
-
 remember rtab[N_REMEMBER][ASSOC];
 
 static unsigned int now = 0;
@@ -363,6 +328,6 @@ void init_trace (char *fname) {
 }
 
 void end_trace (void) {
-	if (compressing) fprintf (stderr, "pred rate: %f ; trace bytes rate: %f\n", nright / (double) ntimes, trace_bytes / (double) total_bytes);
+	if (compressing && ntimes) fprintf (stderr, "pred rate: %f ; trace bytes rate: %f\n", nright / (double) ntimes, trace_bytes / (double) total_bytes);
 	if (tracefp != stdin) pclose (tracefp);
 }
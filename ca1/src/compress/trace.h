@@ -15,3 +15,51 @@ struct trace {
 void init_trace (char *);
 trace *read_trace (void);
 void end_trace (void);
+
+// these are also used by the chunked trace writer in chunk.cc
+
+unsigned char read_byte (void);
+unsigned int read_uint (void);
+extern bool end_of_file;
+
+// the predictor that pre-processes traces remembers traces in a table
+// and keeps a return address stack
+
+struct remember {
+	bool taken;
+	unsigned char code;
+	unsigned int address, target;
+	unsigned int lru_time;
+
+	remember (void) {
+		code = 0;
+		address = 0;
+		target = 0;
+		taken = 0;
+		lru_time = 0;
+	}
+
+	remember (unsigned char c, unsigned int a, unsigned int t, bool ta) {
+		code = c;
+		address = a;
+		target = t;
+		taken = ta;
+	}
+
+	bool equal (remember *r, bool ignore_target) {
+		return
+		   r->code == code
+		&& r->taken == taken
+		&& r->address == address 
+		&& (ignore_target || r->target == target);
+	}
+};
+
+#define RAS_SIZE	100
+#define N_REMEMBER	(1<<16)
+#define ASSOC		8
+
+// write the trace in fname as a chunked trace (see ../chunked.h) to out,
+// with per_chunk traces in a chunk, compressing nthreads chunks at once
+
+void write_chunked (char *fname, FILE *out, int per_chunk, int nthreads);
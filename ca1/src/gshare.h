@@ -0,0 +1,77 @@
+// gshare.h
+// This file contains the gshare predictor that was distributed as the
+// sample my_predictor with the CBP-2 infrastructure, with the table size
+// and history length as template parameters.  With the defaults it is a
+// 32,768-entry gshare with a history length of 15.
+
+class gshare_update : public branch_update {
+public:
+	unsigned int index;
+	unsigned int br_flags;
+};
+
+template <int HISTORY_LENGTH = 15, int TABLE_BITS = 15>
+class gshare_predictor : public slot_predictor<gshare_update > {
+	static_assert (HISTORY_LENGTH <= TABLE_BITS, "history is folded into the table index");
+
+	unsigned int history;
+	unsigned char tab[1<<TABLE_BITS];
+
+public:
+	typedef gshare_predictor with_stats;	// gshare keeps no statistics
+
+	// bits of state: the 2-bit counters and the history
+
+	static constexpr long long int storage_bits (void) {
+		return (1LL << TABLE_BITS) * 2 + HISTORY_LENGTH;
+	}
+
+	gshare_predictor (void) : history(0) { 
+		memset (tab, 0, sizeof (tab));
+	}
+
+	branch_update *predict (branch_info & b) {
+		gshare_update *u = this->update_slot ();
+		u->br_flags = b.br_flags;
+		if (b.br_flags & BR_CONDITIONAL) {
+			u->index = 
+				  (history << (TABLE_BITS - HISTORY_LENGTH)) 
+				^ (b.address & ((1<<TABLE_BITS)-1));
+			u->direction_prediction (tab[u->index] >> 1);
+		} else {
+			u->direction_prediction (true);
+		}
+		u->target_prediction (0);
+		return u;
+	}
+
+	void update (branch_update *u, bool taken, unsigned int target) {
+		gshare_update *gu = (gshare_update *) u;
+		if (gu->br_flags & BR_CONDITIONAL) {
+			unsigned char *c = &tab[gu->index];
+			if (taken) {
+				if (*c < 3) (*c)++;
+			} else {
+				if (*c > 0) (*c)--;
+			}
+			history <<= 1;
+			history |= taken;
+			history &= (1<<HISTORY_LENGTH)-1;
+		}
+	}
+
+	bool save (FILE *f) {
+		int geometry[2] = { HISTORY_LENGTH, TABLE_BITS };
+		return fwrite (geometry, sizeof (geometry), 1, f) == 1
+			&& fwrite (&history, sizeof (history), 1, f) == 1
+			&& fwrite (tab, sizeof (tab), 1, f) == 1;
+	}
+
+	bool restore (FILE *f) {
+		int geometry[2];
+		return fread (geometry, sizeof (geometry), 1, f) == 1
+			&& geometry[0] == HISTORY_LENGTH && geometry[1] == TABLE_BITS
+			&& fread (&history, sizeof (history), 1, f) == 1
+			&& fread (tab, sizeof (tab), 1, f) == 1;
+	}
+};
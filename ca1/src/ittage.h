@@ -0,0 +1,326 @@
+// Target prediction for taken branches: a BTB for conditional branches, ITTAGE (Seznec, CBP-3) for unconditional
+// jumps and calls, and a return address stack for returns, built from the pieces of tage.h. A my_predictor whose Config sets
+// TARGET_PREDICTOR holds a TargetPredictor; with it unset there is no trace of one, and the driver gets target 0
+// for every branch as before
+
+#define BTB_WAYS 4
+
+struct btb_entry
+{
+    uint16_t tag; // Tag of the branch holding the entry
+    uint16_t age; // Branches to the set since this one was last used, for replacement
+    uint32_t target; // Last target of the branch
+};
+
+struct ittage_entry
+{
+    uint16_t tag; // Tag of the branch and history holding the entry
+    uint8_t ctr; // Confidence in the target, 0 to 3
+    uint8_t useful; // Whether the entry has been right where shorter histories weren't
+    uint32_t target; // Predicted target
+};
+
+template <int NUM_COMPONENTS>
+struct target_lookup
+{
+    /*
+    Everything TargetPredictor::predict works out about one branch, handed back to TargetPredictor::update
+    */
+    int btb_set, btb_way; // Entry of the branch in the BTB, way -1 if it has none
+    Index indices[NUM_COMPONENTS]; // Index of the branch in every ITTAGE component
+    Tag tags[NUM_COMPONENTS]; // Tag of the branch in every ITTAGE component
+    int pred_comp, alt_comp; // ITTAGE provider and alternate, 0 for the BTB
+    uint32_t btb_target, pred_target, alt_target, target; // Targets of the BTB, provider and alternate, and the prediction
+};
+
+template <class Config>
+constexpr std::array<int, Config::ITTAGE_COMPONENTS> ittage_history_lengths()
+{
+    /*
+    Geometric series of history lengths, one per ITTAGE component
+    */
+    std::array<int, Config::ITTAGE_COMPONENTS> lengths = {};
+    double power = 1;
+    for (int i = 0; i < Config::ITTAGE_COMPONENTS; i++)
+    {
+        lengths[i] = int(Config::ITTAGE_MIN_HISTORY_LENGTH * power + 0.5);
+        power *= Config::ITTAGE_HISTORY_ALPHA;
+    }
+    return lengths;
+}
+
+template <class Config>
+class TargetPredictor
+{
+    /*
+    The BTB is 4-way set associative with 8 byte entries, each set an aligned 32 byte block. Every branch
+    that goes somewhere other than where its BTB entry says is (re)entered in it, so it predicts the last
+    target of conditional branches and is the base prediction of ITTAGE.
+
+    Every unconditional branch other than a return goes through ITTAGE, not just those marked BR_INDIRECT:
+    the traces mark few branches indirect, while a fifth of the unmarked jumps in gcc and a third of the
+    calls in perlbmk change target. A branch that never does only costs the lookup, since ITTAGE allocates
+    only after a misprediction and its base prediction is the BTB's.
+
+    ITTAGE works like Tage, with targets instead of direction counters: the longest matching history
+    provides the target unless its confidence is 0, when the next longest does. Its global history gets one
+    bit per branch, the outcome of a conditional branch and a bit of the target of any other, and is folded
+    with the same FoldedHistory registers as Tage.
+
+    The traces don't record instruction lengths, so the return address stack holds the addresses of the
+    calls and the length of every call is learnt from the return that comes back after it, in a small
+    table hashed by call address. Calls are mostly 5 bytes long (call rel32), which it starts out with
+    */
+public:
+    static constexpr int BTB_SETS = 1 << Config::BTB_SET_BITS;
+    static constexpr int NUM_COMPONENTS = Config::ITTAGE_COMPONENTS;
+    static constexpr int TABLE_SIZE = 1 << Config::ITTAGE_INDEX_BITS;
+    static constexpr int CTR_MAX = 3;
+    static constexpr int CALL_LENGTHS = 1 << Config::CALL_LENGTH_BITS;
+    static constexpr int DEFAULT_CALL_LENGTH = 5;
+    static constexpr std::array<int, NUM_COMPONENTS> HISTORY_LENGTHS = ittage_history_lengths<Config>();
+    static constexpr int HISTORY_BUFFER_LENGTH = 256;
+
+    static_assert(HISTORY_LENGTHS[NUM_COMPONENTS - 1] <= HISTORY_BUFFER_LENGTH, "history buffer too short for the longest history");
+    static_assert(Config::ITTAGE_INDEX_BITS <= 16 && Config::ITTAGE_TAG_BITS <= 16 && Config::BTB_TAG_BITS <= 16, "indices and tags are 16 bits wide");
+    static_assert((Config::RAS_ENTRIES & (Config::RAS_ENTRIES - 1)) == 0, "the return address stack is a ring of a power of two entries");
+
+    typedef struct target_lookup<NUM_COMPONENTS> Lookup;
+
+private:
+    struct alignas(32) btb_set
+    {
+        struct btb_entry ways[BTB_WAYS];
+    };
+    static_assert(sizeof(btb_set) == 32, "a set should fill 32 bytes");
+
+    btb_set btb[BTB_SETS];
+    alignas(64) struct ittage_entry tables[NUM_COMPONENTS][TABLE_SIZE];
+    BitQueue history; // One bit per branch, most recent first
+    FoldedHistory index_history[NUM_COMPONENTS]; // History folded down to the index width
+    FoldedHistory tag_history[NUM_COMPONENTS]; // History folded down to the tag width
+    uint32_t return_stack[Config::RAS_ENTRIES]; // Addresses of the calls not yet returned from, as a ring
+    int return_top; // Ring position of the most recent call
+    uint8_t call_lengths[CALL_LENGTHS]; // Learnt length of the calls, hashed by address
+    Xorshift32 rng; // Picks the component to allocate in after a misprediction
+
+    uint32_t call_hash(uint32_t call) { return LAST_N_BITS(call ^ (call >> Config::CALL_LENGTH_BITS), Config::CALL_LENGTH_BITS); }
+
+    void push_history(bool bit)
+    {
+#pragma GCC unroll 16
+        for (int i = 0; i < NUM_COMPONENTS; i++)
+        {
+            bool out_bit = history.slice(HISTORY_LENGTHS[i] - 1, HISTORY_LENGTHS[i] - 1);
+            index_history[i].update(bit, out_bit);
+            tag_history[i].update(bit, out_bit);
+        }
+        history.push(bit);
+    }
+
+public:
+    TargetPredictor() : history(HISTORY_BUFFER_LENGTH) {}
+
+    // Bits of state in hardware: BTB entries with 2 bits of LRU order per way, ITTAGE entries and its history
+    // as long as the longest one, the folded registers, the return stack and its top, 4 bit call lengths
+    // and the allocation generator
+    static constexpr long long int storage_bits()
+    {
+        long long int bits = (long long int)BTB_SETS * BTB_WAYS * (Config::BTB_TAG_BITS + 2 + 32);
+        bits += (long long int)NUM_COMPONENTS * TABLE_SIZE * (Config::ITTAGE_TAG_BITS + 2 + 1 + 32);
+        bits += HISTORY_LENGTHS[NUM_COMPONENTS - 1] + NUM_COMPONENTS * (Config::ITTAGE_INDEX_BITS + Config::ITTAGE_TAG_BITS);
+        int top_bits = 0;
+        while ((1 << top_bits) < Config::RAS_ENTRIES)
+            top_bits++;
+        return bits + Config::RAS_ENTRIES * 32 + top_bits + CALL_LENGTHS * 4 + 32;
+    }
+
+    void init()
+    {
+        memset(btb, 0, sizeof(btb));
+        memset(tables, 0, sizeof(tables));
+        for (int i = 0; i < NUM_COMPONENTS; i++)
+        {
+            index_history[i].init(HISTORY_LENGTHS[i], Config::ITTAGE_INDEX_BITS);
+            tag_history[i].init(HISTORY_LENGTHS[i], Config::ITTAGE_TAG_BITS);
+        }
+        memset(return_stack, 0, sizeof(return_stack));
+        return_top = 0;
+        memset(call_lengths, DEFAULT_CALL_LENGTH, sizeof(call_lengths));
+        rng.seed(1);
+    }
+
+    void seed(uint32_t seed) { rng.seed(seed); }
+
+    uint32_t predict(uint32_t ip, unsigned int br_flags, Lookup &lookup)
+    {
+        /*
+        Return the target of the branch if it is taken, recording the lookup for update
+        */
+        lookup.btb_set = LAST_N_BITS(ip, Config::BTB_SET_BITS);
+        uint16_t tag = LAST_N_BITS(ip >> Config::BTB_SET_BITS, Config::BTB_TAG_BITS);
+        lookup.btb_way = -1;
+        lookup.btb_target = 0;
+        for (int i = 0; i < BTB_WAYS; i++)
+        {
+            struct btb_entry &e = btb[lookup.btb_set].ways[i];
+            if (e.tag == tag && e.target)
+            {
+                lookup.btb_way = i;
+                lookup.btb_target = e.target;
+                break;
+            }
+        }
+        lookup.target = lookup.btb_target;
+
+        if (br_flags & BR_RETURN)
+        {
+            uint32_t call = return_stack[return_top];
+            if (call)
+                lookup.target = call + call_lengths[call_hash(call)];
+        }
+        else if (!(br_flags & BR_CONDITIONAL))
+        {
+            uint32_t match = 0;
+#pragma GCC unroll 16
+            for (int i = 0; i < NUM_COMPONENTS; i++)
+            {
+                lookup.indices[i] = LAST_N_BITS(ip ^ (ip >> (Config::ITTAGE_INDEX_BITS - i)) ^ index_history[i].value(), Config::ITTAGE_INDEX_BITS);
+                lookup.tags[i] = LAST_N_BITS(ip ^ (ip >> 3) ^ tag_history[i].value(), Config::ITTAGE_TAG_BITS);
+                if (tables[i][lookup.indices[i]].tag == lookup.tags[i])
+                    match |= 1u << i;
+            }
+            lookup.pred_comp = Tage<Config>::highest_component(match);
+            lookup.alt_comp = Tage<Config>::highest_component(match & ~((1u << lookup.pred_comp) >> 1));
+            lookup.pred_target = lookup.pred_comp ? tables[lookup.pred_comp - 1][lookup.indices[lookup.pred_comp - 1]].target : lookup.btb_target;
+            lookup.alt_target = lookup.alt_comp ? tables[lookup.alt_comp - 1][lookup.indices[lookup.alt_comp - 1]].target : lookup.btb_target;
+            bool confident = lookup.pred_comp == 0 || tables[lookup.pred_comp - 1][lookup.indices[lookup.pred_comp - 1]].ctr > 0;
+            lookup.target = confident ? lookup.pred_target : lookup.alt_target;
+        }
+        return lookup.target;
+    }
+
+    void update(uint32_t ip, unsigned int br_flags, bool taken, uint32_t target, Lookup &lookup)
+    {
+        /*
+        Learn the target of the branch and push it into the history and return address stack
+        */
+        if (!(br_flags & (BR_CONDITIONAL | BR_RETURN)))
+        {
+            if (lookup.pred_comp > 0)
+            {
+                struct ittage_entry &e = tables[lookup.pred_comp - 1][lookup.indices[lookup.pred_comp - 1]];
+                if (lookup.pred_target != lookup.alt_target)
+                {
+                    if (lookup.pred_target == target && e.useful < 1)
+                        e.useful++;
+                    else if (lookup.alt_target == target && e.useful > 0)
+                        e.useful--;
+                }
+                if (e.target == target)
+                {
+                    if (e.ctr < CTR_MAX)
+                        e.ctr++;
+                }
+                else if (e.ctr > 0)
+                    e.ctr--;
+                else
+                    e.target = target; // Replace a target it has no confidence in
+            }
+
+            // Allocate in one longer component after a misprediction, starting at a random one of the next two
+            if (lookup.target != target && lookup.pred_comp < NUM_COMPONENTS)
+            {
+                int start = lookup.pred_comp + 1 + (lookup.pred_comp + 1 < NUM_COMPONENTS && (rng.next() & 1));
+                bool allocated = false;
+                for (int i = start; i <= NUM_COMPONENTS && !allocated; i++)
+                {
+                    struct ittage_entry &e = tables[i - 1][lookup.indices[i - 1]];
+                    if (e.useful == 0)
+                    {
+                        e.tag = lookup.tags[i - 1];
+                        e.target = target;
+                        e.ctr = 0;
+                        allocated = true;
+                    }
+                }
+                if (!allocated)
+                    for (int i = start; i <= NUM_COMPONENTS; i++)
+                        tables[i - 1][lookup.indices[i - 1]].useful = 0;
+            }
+        }
+
+        if (br_flags & BR_RETURN)
+        {
+            uint32_t call = return_stack[return_top];
+            if (call && target - call < 16) // Learn the length of the call this returns past
+                call_lengths[call_hash(call)] = target - call;
+            return_stack[return_top] = 0;
+            return_top = (return_top - 1) & (Config::RAS_ENTRIES - 1);
+        }
+        if (br_flags & BR_CALL)
+        {
+            return_top = (return_top + 1) & (Config::RAS_ENTRIES - 1);
+            return_stack[return_top] = ip;
+        }
+
+        // (Re)enter taken branches that went somewhere else than the BTB says, replacing the least recently used way
+        if (taken)
+        {
+            btb_set &set = btb[lookup.btb_set];
+            int way = lookup.btb_way;
+            if (way < 0 || lookup.btb_target != target)
+            {
+                if (way < 0)
+                {
+                    way = 0;
+                    for (int i = 1; i < BTB_WAYS; i++)
+                        if (set.ways[i].age > set.ways[way].age)
+                            way = i;
+                }
+                set.ways[way].tag = LAST_N_BITS(ip >> Config::BTB_SET_BITS, Config::BTB_TAG_BITS);
+                set.ways[way].target = target;
+            }
+            for (int i = 0; i < BTB_WAYS; i++)
+                if (set.ways[i].age < UINT16_MAX)
+                    set.ways[i].age++;
+            set.ways[way].age = 0;
+        }
+
+        push_history(br_flags & BR_CONDITIONAL ? taken : (target ^ (target >> 2) ^ (target >> 5)) & 1);
+    }
+
+    bool save(FILE *f)
+    {
+        int geometry[4] = { Config::BTB_SET_BITS, NUM_COMPONENTS, Config::ITTAGE_INDEX_BITS, Config::RAS_ENTRIES };
+        bool ok = fwrite(geometry, sizeof(geometry), 1, f) == 1
+               && fwrite(btb, sizeof(btb), 1, f) == 1
+               && fwrite(tables, sizeof(tables), 1, f) == 1
+               && history.save(f)
+               && fwrite(return_stack, sizeof(return_stack), 1, f) == 1
+               && fwrite(&return_top, sizeof(return_top), 1, f) == 1
+               && fwrite(call_lengths, sizeof(call_lengths), 1, f) == 1
+               && rng.save(f);
+        for (int i = 0; i < NUM_COMPONENTS && ok; i++)
+            ok = index_history[i].save(f) && tag_history[i].save(f);
+        return ok;
+    }
+
+    bool restore(FILE *f)
+    {
+        int geometry[4];
+        if (fread(geometry, sizeof(geometry), 1, f) != 1 || geometry[0] != Config::BTB_SET_BITS || geometry[1] != NUM_COMPONENTS
+            || geometry[2] != Config::ITTAGE_INDEX_BITS || geometry[3] != Config::RAS_ENTRIES)
+            return false;
+        bool ok = fread(btb, sizeof(btb), 1, f) == 1
+               && fread(tables, sizeof(tables), 1, f) == 1
+               && history.restore(f)
+               && fread(return_stack, sizeof(return_stack), 1, f) == 1
+               && fread(&return_top, sizeof(return_top), 1, f) == 1 && return_top < Config::RAS_ENTRIES
+               && fread(call_lengths, sizeof(call_lengths), 1, f) == 1
+               && rng.restore(f);
+        for (int i = 0; i < NUM_COMPONENTS && ok; i++)
+            ok = index_history[i].restore(f) && tag_history[i].restore(f);
+        return ok;
+    }
+};
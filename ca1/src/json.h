@@ -0,0 +1,21 @@
+// json.h
+// This file writes strings into JSON output, for the programs that print
+// JSON (suite and profile).  Trace names are paths and can hold any byte.
+
+#include <stdio.h>
+
+// s as a JSON string, quoted and escaped
+
+static void print_json_string (FILE *f, const char *s) {
+	fputc ('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf (f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf (f, "\\u%04x", c);
+		else
+			fputc (c, f);
+	}
+	fputc ('"', f);
+}
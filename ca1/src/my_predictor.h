@@ -1,36 +1,66 @@
 // my_predictor.h
-// This file contains a sample my_predictor class.
-// It is a simple 32,768-entry gshare with a history length of 15.
-// Note that this predictor doesn't use the whole 32 kilobytes available
-// for the CBP-2 contest; it is just an example.
+// This file contains the my_predictor class.
+// It is a TAGE predictor (see tage.h) for conditional branches whose
+// geometry, and whether it adds a loop predictor and a statistical
+// corrector, are given by the Config template parameter; presets.h names
+// the geometries the driver can pick from at run time.  The Stats
+// parameter is TageStats to keep statistics on the predictor, or the
+// default TageNoStats to keep none at no cost.  If the Config asks for
+// target prediction, it also predicts the targets of taken branches with
+// a BTB, ITTAGE and a return address stack (see ittage.h); otherwise
+// every target prediction is 0.
 
 #include "tage.h"
+#include "ittage.h"
 
+// the target predictor, if the Config has one
+
+template <class Config>
+struct my_targets {
+	typedef typename std::conditional<Config::TARGET_PREDICTOR, TargetPredictor<Config>, TageNoComponent>::type type;
+};
+
+template <class Config>
 class my_update : public branch_update {
 public:
 	unsigned int pc, br_flags;
+	typename Tage<Config>::Lookup lookup;	// indices and tags computed by predict, reused by update
+	typename my_targets<Config>::type::Lookup target_lookup;	// the same for the target predictor
 };
 
-class my_predictor : public branch_predictor {
+template <class Config = TageDefaultConfig, template <int> class Stats = TageNoStats>
+class my_predictor : public slot_predictor<my_update<Config> > {
 public:
-	Tage tage_predictor;
+	typedef my_predictor<Config, TageStats> with_stats;	// the same predictor keeping statistics
+
+	Tage<Config, Stats> tage_predictor;
+	typename my_targets<Config>::type target_predictor;
+
+	// bits of state of the direction and target predictors (see Tage::storage_bits)
+	static constexpr long long int storage_bits() {
+		return Tage<Config, Stats>::storage_bits() + my_targets<Config>::type::storage_bits();
+	}
 
 	my_predictor(void) {
 		tage_predictor.init();
+		target_predictor.init();
 	}
 
 	branch_update* predict(branch_info & b) {
 		// Debug print
 		// printf("Predict branch @ PC %x\r\n", b.address);
 		bool pred;
-		my_update* u;
-		u = new my_update();
+		my_update<Config>* u;
+		u = this->update_slot();
 		u->pc = b.address;
 		u->br_flags = b.br_flags;
-		u->target_prediction(0);
+		if constexpr (Config::TARGET_PREDICTOR)
+			u->target_prediction(target_predictor.predict(b.address, b.br_flags, u->target_lookup));
+		else
+			u->target_prediction(0);
 
 		if (b.br_flags & BR_CONDITIONAL) {
-			pred = tage_predictor.predict(b.address);
+			pred = tage_predictor.predict(b.address, u->lookup);
 			// Debug print
 			// printf("pred=%x\r\n", pred);
 			u->direction_prediction(pred);
@@ -41,12 +71,35 @@ public:
 	}
 
 	void update(branch_update *u, bool taken, unsigned int target) {
-		my_update* mu = (my_update*)u;
+		my_update<Config>* mu = (my_update<Config>*)u;
 		// Debug print
 		// printf("Update branch @ PC %x\r\n", mu->pc);
 		if (mu->br_flags & BR_CONDITIONAL) {
-			tage_predictor.update(mu->pc, taken);
+			tage_predictor.update(mu->pc, taken, mu->lookup);
 		}
-		delete mu;
+		if constexpr (Config::TARGET_PREDICTOR)
+			target_predictor.update(mu->pc, mu->br_flags, taken, target, mu->target_lookup);
+	}
+
+	void seed(unsigned int s) {
+		tage_predictor.seed(s);
+		if constexpr (Config::TARGET_PREDICTOR)
+			target_predictor.seed(s);
+	}
+
+	bool save(FILE *f) {
+		return tage_predictor.save(f) && target_predictor.save(f);
+	}
+
+	bool restore(FILE *f) {
+		return tage_predictor.restore(f) && target_predictor.restore(f);
+	}
+
+	bool predicts_targets(void) {
+		return Config::TARGET_PREDICTOR;
+	}
+
+	bool print_stats(FILE *f) {
+		return tage_predictor.print_stats(f);
 	}
 };
@@ -0,0 +1,155 @@
+// perceptron.h
+// This file contains a perceptron predictor (Jimenez and Lin, HPCA 2001)
+// with 8-bit weights.  Every branch is hashed to a row of weights, one
+// for each bit of global history plus a bias weight.  The prediction is
+// the sign of the bias plus the sum of the other weights, each negated
+// where its history bit is not taken; when the prediction is wrong or
+// the sum is within THRESHOLD of zero, every weight moves one step
+// toward agreeing with the outcome, saturating at -127 and 127 (not
+// -128, whose negation doesn't fit in 8 bits).
+//
+// The weights of a row sit next to each other in whole 32-byte vectors,
+// so that with AVX2 the sum is a few sign, multiply-add and add
+// instructions over one or two vectors and training is one saturating
+// add per vector.  Without AVX2 the same arithmetic is done a weight at
+// a time, with the same results.
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+class perceptron_update : public branch_update {
+public:
+	unsigned int row;
+	unsigned int br_flags;
+	int output;		// the sum the prediction was made from
+};
+
+template <int HISTORY_LENGTH = 63, int ROW_BITS = 10>
+class perceptron_predictor : public slot_predictor<perceptron_update > {
+	static_assert (HISTORY_LENGTH >= 1 && HISTORY_LENGTH <= 63, "history and bias fit in 64 bits");
+
+	// training threshold from the paper, and the bytes in a row rounded
+	// up to whole vectors
+
+	static constexpr int THRESHOLD = (int) (1.93 * HISTORY_LENGTH + 14);
+	static constexpr int ROW_BYTES = (HISTORY_LENGTH + 1 + 31) & ~31;
+
+	// bit 0 is always 1 for the bias weight; bit i is the outcome of
+	// the i-th most recent conditional branch
+
+	unsigned long long history;
+	alignas (32) signed char weights[1<<ROW_BITS][ROW_BYTES];
+
+#ifdef __AVX2__
+	// +1 for each weight in the 32 starting at weight first whose
+	// history bit is taken (or that is the bias), -1 where it isn't,
+	// and 0 past the end of the history
+
+	__m256i signs (int first) {
+		__m256i bits = _mm256_set1_epi32 ((unsigned int) (history >> first));
+		bits = _mm256_shuffle_epi8 (bits, _mm256_setr_epi64x (0, 0x0101010101010101LL, 0x0202020202020202LL, 0x0303030303030303LL));
+		__m256i mask = _mm256_set1_epi64x (0x8040201008040201LL);
+		__m256i set = _mm256_cmpeq_epi8 (_mm256_and_si256 (bits, mask), mask);
+		__m256i s = _mm256_or_si256 (_mm256_andnot_si256 (set, _mm256_set1_epi8 (-1)), _mm256_set1_epi8 (1));
+		__m256i lane = _mm256_setr_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+			16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+		__m256i valid = _mm256_cmpgt_epi8 (_mm256_set1_epi8 (HISTORY_LENGTH + 1 - first), lane);
+		return _mm256_and_si256 (s, valid);
+	}
+#endif
+
+	int output (unsigned int row) {
+		signed char *w = weights[row];
+#ifdef __AVX2__
+		__m256i sum = _mm256_setzero_si256 ();
+		for (int i=0; i<ROW_BYTES; i+=32) {
+			__m256i x = _mm256_sign_epi8 (_mm256_load_si256 ((__m256i *) (w + i)), signs (i));
+
+			// widen to 16 and then 32 bits while adding neighbours
+
+			x = _mm256_maddubs_epi16 (_mm256_set1_epi8 (1), x);
+			sum = _mm256_add_epi32 (sum, _mm256_madd_epi16 (x, _mm256_set1_epi16 (1)));
+		}
+		__m128i s = _mm_add_epi32 (_mm256_castsi256_si128 (sum), _mm256_extracti128_si256 (sum, 1));
+		s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0x4e));
+		s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0xb1));
+		return _mm_cvtsi128_si32 (s);
+#else
+		int y = 0;
+		for (int i=0; i<=HISTORY_LENGTH; i++)
+			y += (history >> i) & 1 ? w[i] : -w[i];
+		return y;
+#endif
+	}
+
+	void train (unsigned int row, bool taken) {
+		signed char *w = weights[row];
+#ifdef __AVX2__
+		__m256i t = _mm256_set1_epi8 (taken ? 1 : -1);
+		for (int i=0; i<ROW_BYTES; i+=32) {
+			__m256i *p = (__m256i *) (w + i);
+			__m256i x = _mm256_adds_epi8 (_mm256_load_si256 (p), _mm256_sign_epi8 (signs (i), t));
+			_mm256_store_si256 (p, _mm256_max_epi8 (x, _mm256_set1_epi8 (-127)));
+		}
+#else
+		for (int i=0; i<=HISTORY_LENGTH; i++) {
+			int x = (history >> i) & 1 ? 1 : -1;
+			int v = w[i] + (taken ? x : -x);
+			w[i] = v > 127 ? 127 : v < -127 ? -127 : v;
+		}
+#endif
+	}
+
+public:
+	typedef perceptron_predictor with_stats;	// the perceptron keeps no statistics
+
+	// bits of state: the 8-bit weights of every row, not counting the
+	// padding to whole vectors, and the history
+
+	static constexpr long long int storage_bits (void) {
+		return (1LL << ROW_BITS) * (HISTORY_LENGTH + 1) * 8 + HISTORY_LENGTH;
+	}
+
+	perceptron_predictor (void) : history(1) {
+		memset (weights, 0, sizeof (weights));
+	}
+
+	branch_update *predict (branch_info & b) {
+		perceptron_update *u = this->update_slot ();
+		u->br_flags = b.br_flags;
+		if (b.br_flags & BR_CONDITIONAL) {
+			u->row = (b.address ^ (b.address >> ROW_BITS)) & ((1<<ROW_BITS)-1);
+			u->output = output (u->row);
+			u->direction_prediction (u->output >= 0);
+		} else {
+			u->direction_prediction (true);
+		}
+		u->target_prediction (0);
+		return u;
+	}
+
+	void update (branch_update *u, bool taken, unsigned int target) {
+		perceptron_update *pu = (perceptron_update *) u;
+		if (pu->br_flags & BR_CONDITIONAL) {
+			if ((pu->output >= 0) != taken || abs (pu->output) <= THRESHOLD)
+				train (pu->row, taken);
+			history = (history << 1 & ((2ULL << HISTORY_LENGTH) - 4)) | (unsigned long long) taken << 1 | 1;
+		}
+	}
+
+	bool save (FILE *f) {
+		int geometry[2] = { HISTORY_LENGTH, ROW_BITS };
+		return fwrite (geometry, sizeof (geometry), 1, f) == 1
+			&& fwrite (&history, sizeof (history), 1, f) == 1
+			&& fwrite (weights, sizeof (weights), 1, f) == 1;
+	}
+
+	bool restore (FILE *f) {
+		int geometry[2];
+		return fread (geometry, sizeof (geometry), 1, f) == 1
+			&& geometry[0] == HISTORY_LENGTH && geometry[1] == ROW_BITS
+			&& fread (&history, sizeof (history), 1, f) == 1
+			&& fread (weights, sizeof (weights), 1, f) == 1;
+	}
+};
@@ -1,84 +1,286 @@
 // predict.cc
-// This file contains the main function.  The program accepts a single 
-// parameter: the name of a trace file.  It drives the branch predictor
-// simulation by reading the trace file and feeding the traces one at a time
-// to the branch predictor.
+// This file contains the main function.  The program accepts the name
+// of a trace file and, optionally, "-p <preset>" naming the predictor
+// geometry to simulate (see presets.h; "-l" lists them).  Several
+// presets may be given, separated by commas or with more -p options;
+// the trace is then decoded once and fed to all of them, each on its
+// own thread with -t.  With "-c <dir>" (or CBP_TRACE_CACHE set in the
+// environment) the trace is read through a cache of decoded traces in
+// that directory; see trace.cc.  "-s <period>,<warmup>,<measure>" and
+// "-r <clusters>,<interval>,<warmup>" estimate the MPKI from samples of
+// the trace instead of simulating all of it; see sample.h.
+// "-k <every>,<prefix>" writes a checkpoint of the predictors to
+// <prefix>.<traces>.ckp every so many traces, "-R <checkpoint>" picks
+// up the simulation from one, and "-e <traces>" stops after that many
+// traces; see checkpoint.h.  "-j <segments>,<warmup>" simulates the
+// trace as that many segments at once, each on its own thread after its
+// own warm-up, and with "-v" serially as well to show the difference;
+// see segment.h.  "-S" builds the predictors keeping statistics and
+// prints them after the MPKI.  Without sampling or segments, the target
+// MPKI (mispredicted targets of taken branches, see simulate.h) of a
+// preset that predicts targets is printed too, before the MPKI, which
+// stays the last line.  "-x <seed>" seeds the pseudo-random
+// choices of the predictors, which otherwise start from the same seed
+// on every run.  It drives the branch predictor simulation by
+// reading the trace file and feeding the traces one at a time to the
+// branch predictors.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // in case you want to use e.g. memset
 #include <assert.h>
+#include <limits.h>
 
 #include "branch.h"
 #include "trace.h"
 #include "predictor.h"
 #include "my_predictor.h"
+#include "gshare.h"
+#include "perceptron.h"
+#include "presets.h"
+#include "simulate.h"
+#include "sample.h"
+#include "checkpoint.h"
+#include "segment.h"
 
-int main (int argc, char *argv[]) {
+static void usage (char *prog) {
+	fprintf (stderr, "Usage: %s [ -t ] [ -S ] [ -x <seed> ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] ]... <filename>.gz\n", prog);
+	fprintf (stderr, "       %s [ -S ] [ -x <seed> ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] ]... -s <period>,<warmup>,<measure> <filename>.gz\n", prog);
+	fprintf (stderr, "       %s [ -S ] [ -x <seed> ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] ]... -r <clusters>,<interval>,<warmup> <filename>.gz\n", prog);
+	fprintf (stderr, "       %s [ -S ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] | -R <checkpoint> ] [ -k <every>,<prefix> ] [ -e <traces> ] <filename>.gz\n", prog);
+	fprintf (stderr, "       %s [ -x <seed> ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] ]... -j <segments>,<warmup> [ -v ] <filename>.gz\n", prog);
+	fprintf (stderr, "       %s -l\n", prog);
+	exit (1);
+}
 
-	// make sure there is one parameter
+// print the statistics every predictor kept
 
-	if (argc != 2) {
-		fprintf (stderr, "Usage: %s <filename>.gz\n", argv[0]);
-		exit (1);
+static void print_stats (std::vector<predictor_run> & runs) {
+	for (size_t i=0; i<runs.size (); i++) {
+		printf ("\n%s:\n", runs[i].name);
+		if (!runs[i].p->print_stats (stdout)) printf ("no statistics\n");
 	}
+}
 
-	// open the trace file for reading
-
-	init_trace (argv[1]);
-
-	// initialize competitor's branch prediction code
-
-	branch_predictor *p = new my_predictor ();
-
-	// some statistics to keep, currently just for conditional branches
+int main (int argc, char *argv[]) {
 
-	long long int 
-		tmiss = 0, 	// number of target mispredictions
-		dmiss = 0; 	// number of direction mispredictions
+	std::vector<char *> presets;
+	char *fname = NULL;
+	const char *cache_dir = getenv ("CBP_TRACE_CACHE");
+	bool threaded = false, verify = false, stats = false;
+	long long int sample[3] = { 0, 0, 0 }, simpoint[3] = { 0, 0, 0 };
+	long long int every = 0, stop = 0, segments[2] = { 0, 0 }, seed = -1;
+	char *prefix = NULL, *resume = NULL;
 
-	// keep looping until end of file
+	// parse the options; there must be exactly one trace file
 
-	for (;;) {
+	for (int i=1; i<argc; i++) {
+		if (strcmp (argv[i], "-p") == 0 && i+1 < argc) {
+			for (char *name = strtok (argv[++i], ","); name; name = strtok (NULL, ","))
+				presets.push_back (name);
+		} else if (strcmp (argv[i], "-t") == 0)
+			threaded = true;
+		else if (strcmp (argv[i], "-c") == 0 && i+1 < argc)
+			cache_dir = argv[++i];
+		else if (strcmp (argv[i], "-s") == 0 && i+1 < argc) {
+			if (sscanf (argv[++i], "%lld,%lld,%lld", &sample[0], &sample[1], &sample[2]) != 3
+			 || sample[2] < 1 || sample[1] < 0 || sample[0] < sample[1] + sample[2]) usage (argv[0]);
+		} else if (strcmp (argv[i], "-r") == 0 && i+1 < argc) {
+			if (sscanf (argv[++i], "%lld,%lld,%lld", &simpoint[0], &simpoint[1], &simpoint[2]) != 3
+			 || simpoint[0] < 1 || simpoint[1] < 1 || simpoint[2] < 0) usage (argv[0]);
+		} else if (strcmp (argv[i], "-k") == 0 && i+1 < argc) {
+			char *comma = strchr (argv[++i], ',');
+			if (!comma || !comma[1]) usage (argv[0]);
+			*comma = 0;
+			every = atoll (argv[i]);
+			prefix = comma + 1;
+			if (every < 1) usage (argv[0]);
+		} else if (strcmp (argv[i], "-R") == 0 && i+1 < argc)
+			resume = argv[++i];
+		else if (strcmp (argv[i], "-e") == 0 && i+1 < argc) {
+			stop = atoll (argv[++i]);
+			if (stop < 1) usage (argv[0]);
+		} else if (strcmp (argv[i], "-j") == 0 && i+1 < argc) {
+			if (sscanf (argv[++i], "%lld,%lld", &segments[0], &segments[1]) != 2
+			 || segments[0] < 1 || segments[1] < 0) usage (argv[0]);
+		} else if (strcmp (argv[i], "-v") == 0)
+			verify = true;
+		else if (strcmp (argv[i], "-S") == 0)
+			stats = true;
+		else if (strcmp (argv[i], "-x") == 0 && i+1 < argc) {
+			seed = atoll (argv[++i]);
+			if (seed < 0 || seed > 0xffffffffLL) usage (argv[0]);
+		}
+		else if (strcmp (argv[i], "-l") == 0) {
+			list_presets (stdout);
+			exit (0);
+		} else if (argv[i][0] != '-' && !fname)
+			fname = argv[i];
+		else
+			usage (argv[0]);
+	}
+	if (!fname) usage (argv[0]);
 
-		// get a trace
+	// a checkpoint brings its own presets, and sampling starts from scratch
 
-		trace *t = read_trace ();
+	bool segment = every || stop || resume;
+	if (resume && !presets.empty ()) usage (argv[0]);
+	if (segment && (sample[0] || simpoint[0])) usage (argv[0]);
+	if (segments[0] && (segment || sample[0] || simpoint[0])) usage (argv[0]);
+	if (verify && !segments[0]) usage (argv[0]);
+	if (stats && segments[0]) usage (argv[0]);
+	if (resume && seed >= 0) usage (argv[0]);
+	if (presets.empty () && !resume) presets.push_back ((char *) "tage");
 
-		// NULL means end of file
+	// initialize competitors' branch prediction code
 
-		if (!t) break;
+	std::vector<predictor_run> runs;
+	unsigned long long position = 0;
+	if (resume && !load_checkpoint (resume, position, runs, stats)) exit (1);
+	for (size_t i=0; i<presets.size (); i++) {
+		branch_predictor *p = make_predictor (presets[i], stats);
+		if (!p) {
+			fprintf (stderr, "%s: unknown preset \"%s\"; try -l\n", argv[0], presets[i]);
+			exit (1);
+		}
+		if (seed >= 0) p->seed (seed);
+		runs.push_back (predictor_run (presets[i], p));
+	}
 
-		// send this trace to the competitor's code for prediction
+	// estimate from samples, if asked to
 
-		branch_update *u = p->predict (t->bi);
+	if (sample[0] || simpoint[0]) {
+		std::vector<mpki_estimate> est;
+		if (simpoint[0])
+			simulate_simpoints (fname, cache_dir, runs, simpoint[1], simpoint[0], simpoint[2], est);
+		else {
+			trace_reader *tr = open_trace (fname, cache_dir);
+			if (!tr) exit (1);
+			simulate_sampled (tr, runs, sample[0], sample[1], sample[2], est);
+			close_trace (tr);
+		}
+		const char *what = simpoint[0] ? "intervals" : "samples";
+		if (runs.size () == 1) {
+			if (simpoint[0])
+				printf ("%0.3f MPKI (%d %s)\n", est[0].mpki, est[0].samples, what);
+			else
+				printf ("%0.3f MPKI +- %0.3f (95%% confidence, %d %s)\n", est[0].mpki, est[0].ci, est[0].samples, what);
+		} else {
+			printf ("%-16s%10s%10s\n", "preset", "MPKI", "+-95%");
+			for (size_t i=0; i<runs.size (); i++)
+				printf ("%-16s%10.3f%10.3f\n", runs[i].name, est[i].mpki, est[i].ci);
+		}
+		if (stats) print_stats (runs);
+		for (size_t i=0; i<runs.size (); i++)
+			delete runs[i].p;
+		exit (0);
+	}
 
-		// collect statistics for a conditional branch trace
+	// simulate segments at once, if asked to
 
-		if (t->bi.br_flags & BR_CONDITIONAL) {
+	if (segments[0]) {
+		if (simulate_segments (fname, cache_dir, runs, segments[0], segments[1], seed) < 0) {
+			fprintf (stderr, "%s: segments need a chunked or cached trace; try -c\n", fname);
+			exit (1);
+		}
+		std::vector<predictor_run> serial;
+		if (verify) {
+			for (size_t i=0; i<runs.size (); i++) {
+				serial.push_back (predictor_run (runs[i].name, make_predictor (runs[i].name)));
+				if (seed >= 0) serial.back ().p->seed (seed);
+			}
+			trace_reader *tr = open_trace (fname, cache_dir);
+			if (!tr) exit (1);
+			simulate (tr, serial, threaded);
+			close_trace (tr);
+		}
+		if (runs.size () == 1 && !verify)
+			printf ("%0.3f MPKI (%lld segments)\n", 1000.0 * (runs[0].dmiss / 1e8), segments[0]);
+		else if (runs.size () == 1)
+			printf ("%0.3f MPKI (%lld segments; serial %0.3f MPKI, error %+0.3f%%)\n",
+				1000.0 * (runs[0].dmiss / 1e8), segments[0], 1000.0 * (serial[0].dmiss / 1e8),
+				100.0 * (runs[0].dmiss - serial[0].dmiss) / std::max (serial[0].dmiss, 1LL));
+		else {
+			printf ("%-16s%10s", "preset", "MPKI");
+			if (verify) printf ("%10s%10s", "serial", "error%");
+			printf ("\n");
+			for (size_t i=0; i<runs.size (); i++) {
+				printf ("%-16s%10.3f", runs[i].name, 1000.0 * (runs[i].dmiss / 1e8));
+				if (verify)
+					printf ("%10.3f%+10.3f", 1000.0 * (serial[i].dmiss / 1e8),
+						100.0 * (runs[i].dmiss - serial[i].dmiss) / std::max (serial[i].dmiss, 1LL));
+				printf ("\n");
+			}
+		}
+		for (size_t i=0; i<runs.size (); i++) {
+			delete runs[i].p;
+			if (verify) delete serial[i].p;
+		}
+		exit (0);
+	}
 
-			// count a direction misprediction
+	// open the trace file for reading
 
-			dmiss += u->direction_prediction () != t->taken;
+	trace_reader *tr = open_trace (fname, cache_dir);
+	if (!tr) exit (1);
 
-			// count a target misprediction
+	// keep feeding traces to the predictors until end of file, or from
+	// checkpoint to checkpoint up to the end of the segment
 
-			tmiss += u->target_prediction () != t->target;
+	long long int branches = 0;
+	if (!segment)
+		branches = simulate (tr, runs, threaded);
+	else {
+		if (position && !seek_trace (tr, position)) {
+			fprintf (stderr, "%s: can't seek to trace %llu\n", fname, position);
+			exit (1);
 		}
-
-		// update competitor's state
-
-		p->update (u, t->taken, t->target);
+		trace *batch = new trace[RING_BATCH];
+		long long int pos = position, end = stop ? stop : LLONG_MAX;
+		while (pos < end) {
+			long long int want = end - pos;
+			if (every) want = std::min (want, every - pos % every);
+			long long int n = simulate_window (tr, runs, want, batch);
+			pos += n;
+			if (n < want) break;
+			if (every && pos % every == 0) {
+				char name[1024];
+				snprintf (name, sizeof (name), "%s.%lld.ckp", prefix, pos);
+				if (!save_checkpoint (name, pos, runs)) exit (1);
+			}
+		}
+		delete[] batch;
+		branches = pos - position;
 	}
 
 	// done reading traces
 
-	end_trace ();
+	close_trace (tr);
 
 	// give final mispredictions per kilo-instruction and exit.
 	// each trace represents exactly 100 million instructions.
+	// with several predictors, also give how fast each one went.
 
-	printf ("%0.3f MPKI\n", 1000.0 * (dmiss / 1e8));
-	delete p;
+	if (runs.size () == 1) {
+		// the MPKI stays the last line, which the run script reads
+
+		long long int dmiss = runs[0].dmiss;
+		if (runs[0].p->predicts_targets ())
+			printf ("%0.3f target MPKI\n", 1000.0 * (runs[0].tmiss / 1e8));
+		printf ("%0.3f MPKI\n", 1000.0 * (dmiss / 1e8));
+	} else {
+		printf ("%-16s%10s%14s%14s\n", "preset", "MPKI", "target MPKI", "branches/s");
+		for (size_t i=0; i<runs.size (); i++) {
+			printf ("%-16s%10.3f", runs[i].name, 1000.0 * (runs[i].dmiss / 1e8));
+			if (runs[i].p->predicts_targets ())
+				printf ("%14.3f", 1000.0 * (runs[i].tmiss / 1e8));
+			else
+				printf ("%14s", "-");
+			printf ("%14.0f\n", branches / std::max (runs[i].seconds, 1e-9));
+		}
+	}
+	if (stats) print_stats (runs);
+	for (size_t i=0; i<runs.size (); i++)
+		delete runs[i].p;
 	exit (0);
 }
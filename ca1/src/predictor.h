@@ -1,5 +1,12 @@
 // predictor.h
 // This file declares branch_update and branch_predictor classes.
+//
+// The branch_update returned by predict belongs to the predictor and only
+// has to stay valid until the matching call to update; the driver always
+// updates a branch before predicting the next one.  A predictor may
+// allocate a fresh branch_update for every branch and delete it in
+// update, or derive from slot_predictor and hand out the same one every
+// time without touching the heap.
 
 class branch_update {
 	bool _direction_prediction;
@@ -9,7 +16,7 @@ public:
 	bool direction_prediction () { return _direction_prediction; }
 	void direction_prediction (bool b) { _direction_prediction = b; }
 
-	bool target_prediction () { return _target_prediction; }
+	unsigned int target_prediction () { return _target_prediction; }
 	void target_prediction (unsigned int t) { _target_prediction = t; }
 
 	branch_update (void) : 
@@ -20,5 +27,40 @@ class branch_predictor {
 public:
 	virtual branch_update *predict (branch_info &) = 0;
 	virtual void update (branch_update *, bool, unsigned int) {}
+
+	// write the complete state of the predictor to a file, or read back
+	// what save wrote.  false if the predictor can't, or if the state
+	// is from a different predictor.  see checkpoint.h.
+
+	virtual bool save (FILE *) { return false; }
+	virtual bool restore (FILE *) { return false; }
+
+	// seed whatever pseudo-random choices the predictor makes, so that
+	// runs can differ from each other or repeat exactly
+
+	virtual void seed (unsigned int) {}
+
+	// true if predict fills in target_prediction; the target misses of a
+	// predictor that doesn't mean nothing
+
+	virtual bool predicts_targets (void) { return false; }
+
+	// print whatever statistics the predictor kept beyond its misses;
+	// false if it kept none
+
+	virtual bool print_stats (FILE *) { return false; }
 	virtual ~branch_predictor (void) {}
 };
+
+// a branch_predictor that keeps its branch_update, a U, in a slot inside
+// the predictor.  predict fills in the slot and returns it; it has to set
+// every field update will look at, since the slot is not cleared between
+// branches.
+
+template <class U>
+class slot_predictor : public branch_predictor {
+	U _slot;
+
+protected:
+	U *update_slot (void) { return &_slot; }
+};
@@ -0,0 +1,111 @@
+// presets.h
+// This file names the predictor geometries the driver can build at run
+// time with "-p <name>", so trying a different geometry does not need
+// a rebuild.  To add one, describe it with a TageConfig (deriving from
+// it if the components should differ) and add a line to the table,
+// which also gives the storage the predictor needs (-l lists it).
+// Every preset can also be built keeping statistics (predict -S); the
+// predictor names the class that does with its with_stats typedef.
+
+// eight components over a slower-growing history
+
+struct Tage8Config : TageConfig<8, 11, 10> {
+	static constexpr double HISTORY_ALPHA = 2.0;
+};
+
+// tags that widen with the history length, as in the CBP TAGE entries
+
+struct TageWideTagsConfig : TageConfig<5, 12, 9> {
+	static constexpr int tag_bits (int component) { return 8 + component; }
+};
+
+// the default geometry with a loop predictor, a statistical corrector,
+// or both (TAGE-SC-L)
+
+struct TageLoopConfig : TageDefaultConfig {
+	static constexpr bool LOOP_PREDICTOR = true;
+};
+
+struct TageScConfig : TageDefaultConfig {
+	static constexpr bool STATISTICAL_CORRECTOR = true;
+};
+
+struct TageScLoopConfig : TageDefaultConfig {
+	static constexpr bool LOOP_PREDICTOR = true;
+	static constexpr bool STATISTICAL_CORRECTOR = true;
+};
+
+// the default geometry, and TAGE-SC-L, predicting targets as well
+
+struct TageTargetsConfig : TageDefaultConfig {
+	static constexpr bool TARGET_PREDICTOR = true;
+};
+
+struct TageScLoopTargetsConfig : TageScLoopConfig {
+	static constexpr bool TARGET_PREDICTOR = true;
+};
+
+struct predictor_preset {
+	const char *name;
+	const char *description;
+	branch_predictor *(*make) (bool stats);
+	long long int storage_bits;	// state it would need in hardware; see storage_bits in each predictor
+};
+
+template <class P>
+branch_predictor *make_preset (bool stats) {
+	if (stats) return new typename P::with_stats ();
+	return new P ();
+}
+
+// the table entry for predictor class P
+
+template <class P>
+constexpr predictor_preset preset (const char *name, const char *description) {
+	return { name, description, make_preset<P>, P::storage_bits () };
+}
+
+static const predictor_preset predictor_presets[] = {
+	preset<my_predictor<> > ("tage", "5 x 4K-entry tagged tables, 9-bit tags, 3-bit counters (default)"),
+	preset<my_predictor<TageConfig<4, 12, 9> > > ("tage-4", "4 x 4K-entry tagged tables, 9-bit tags"),
+	preset<my_predictor<TageConfig<6, 12, 9> > > ("tage-6", "6 x 4K-entry tagged tables, 9-bit tags"),
+	preset<my_predictor<TageConfig<5, 10, 8> > > ("tage-small", "5 x 1K-entry tagged tables, 8-bit tags"),
+	preset<my_predictor<TageConfig<5, 13, 11> > > ("tage-large", "5 x 8K-entry tagged tables, 11-bit tags"),
+	preset<my_predictor<TageConfig<5, 12, 9, 4> > > ("tage-ctr4", "5 x 4K-entry tagged tables, 9-bit tags, 4-bit counters"),
+	preset<my_predictor<Tage8Config> > ("tage-8", "8 x 2K-entry tagged tables, 10-bit tags, history alpha 2"),
+	preset<my_predictor<TageWideTagsConfig> > ("tage-widetags", "5 x 4K-entry tagged tables, 8- to 12-bit tags"),
+	preset<my_predictor<TageLoopConfig> > ("tage-l", "tage with a 256-entry loop predictor"),
+	preset<my_predictor<TageScConfig> > ("tage-sc", "tage with an 8 x 1K-counter statistical corrector"),
+	preset<my_predictor<TageScLoopConfig> > ("tage-sc-l", "tage with both (TAGE-SC-L)"),
+	preset<my_predictor<TageTargetsConfig> > ("tage-ittage", "tage with a 4K-entry BTB, 4 x 512-entry ITTAGE and a 16-entry return stack"),
+	preset<my_predictor<TageScLoopTargetsConfig> > ("tage-sc-l-ittage", "tage-sc-l with the targets of tage-ittage"),
+	preset<gshare_predictor<> > ("gshare", "32K-entry gshare, 15-bit history (the CBP-2 sample predictor)"),
+	preset<gshare_predictor<16, 16> > ("gshare-64k", "64K-entry gshare, 16-bit history"),
+	preset<perceptron_predictor<> > ("perceptron", "1K rows of 64 8-bit weights, 63-bit history"),
+	preset<perceptron_predictor<31, 11> > ("perceptron-32", "2K rows of 32 8-bit weights, 31-bit history"),
+	preset<perceptron_predictor<31, 9> > ("perceptron-small", "512 rows of 32 8-bit weights, 31-bit history"),
+	{ NULL, NULL, NULL, 0 },
+};
+
+// the preset called name, or NULL if there is none
+
+const predictor_preset *find_preset (const char *name) {
+	for (const predictor_preset *p = predictor_presets; p->name; p++)
+		if (strcmp (p->name, name) == 0) return p;
+	return NULL;
+}
+
+// build the predictor called name, keeping statistics if stats is
+// true, or return NULL if there is none
+
+branch_predictor *make_predictor (const char *name, bool stats = false) {
+	const predictor_preset *p = find_preset (name);
+	return p ? p->make (stats) : NULL;
+}
+
+// print the names, storage and descriptions of the presets
+
+void list_presets (FILE *f) {
+	for (const predictor_preset *p = predictor_presets; p->name; p++)
+		fprintf (f, "%-18s%9.2f KB  %s\n", p->name, p->storage_bits / 8192.0, p->description);
+}
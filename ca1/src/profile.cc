@@ -0,0 +1,454 @@
+// profile.cc
+// This file contains the main function of the trace profiler, which
+// describes what is in branch traces before a predictor is tuned for
+// them.  It reads every trace file named, or found under a directory
+// named, once through the trace decoder, with a pool of threads across
+// the traces, and writes a JSON profile of each one: the mix of branches
+// by kind (br_flags), the taken rate of each conditional opcode, the
+// number of static branches, how biased they are, how far back global
+// history helps to predict them, how many entries they would take and
+// how often they would collide in tables of various sizes, and how many
+// of them are live at a time.
+//
+// Memory is bounded whatever the length or number of the traces: each
+// thread builds the tables of the trace it is on, and only the JSON is
+// kept once the trace is done.  Static branches are kept in a hashed,
+// set associative table of 2^PROFILE_PC_BITS entries; a branch that
+// finds no room in its set is counted as untracked, and the number of
+// static branches is also estimated with a HyperLogLog sketch
+// that has no such limit.  History correlation is measured with tables
+// of 2-bit counters indexed by a hash of the PC and the last L outcomes,
+// one table per history length L, of PROFILE_CORRELATION_BITS entries:
+// the history length beyond which the counters stop getting better is
+// the correlation depth.
+//
+// "-o <dir>" writes <dir>/<name>.json for every <name>.trace.* file
+// instead of one JSON array to standard output.  "-w <branches>" sets
+// the window the working set is measured over, "-j <threads>" the pool
+// size, and "-c <cache-dir>" reads through a trace cache as predict does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "json.h"
+
+#define PROFILE_PC_BITS			16	// static branches tracked, as a power of two
+#define PROFILE_PC_WAYS			8
+#define PROFILE_HLL_BITS		12	// registers of the HyperLogLog sketch, as a power of two
+#define PROFILE_CORRELATION_BITS	18	// counters per correlation table, as a power of two
+#define PROFILE_DEFAULT_WINDOW		1000000
+
+static const int correlation_lengths[] = { 0, 2, 4, 8, 16, 32, 64 };
+#define PROFILE_LENGTHS	(int) (sizeof (correlation_lengths) / sizeof (correlation_lengths[0]))
+
+static const int footprint_bits[] = { 10, 12, 14, 16 };
+#define PROFILE_FOOTPRINTS	(int) (sizeof (footprint_bits) / sizeof (footprint_bits[0]))
+
+static const char *opcode_names[16] = {
+	"JO", "JNO", "JC", "JNC", "JZ", "JNZ", "JBE", "JA",
+	"JS", "JNS", "JP", "JNP", "JL", "JGE", "JLE", "JG",
+};
+
+// the bias classes of static conditional branches, by the fraction of
+// their executions that go their usual way
+
+static const double bias_limits[] = { 0.6, 0.7, 0.8, 0.9, 0.95, 0.99, 1.0 };
+#define PROFILE_BIASES	(int) (sizeof (bias_limits) / sizeof (bias_limits[0]) + 1)
+
+// a static branch
+
+struct pc_entry {
+	unsigned int pc;
+	unsigned int flags;		// OR of the br_flags it was seen with
+	long long int window;		// last working set window it was seen in, -1 if none
+	long long int count, conditional, taken;
+};
+
+// everything kept about one trace while it is read
+
+struct trace_profile {
+	std::string fname;
+	bool failed;
+
+	long long int branches, untracked;
+	long long int flags_count[16];
+	long long int opcode_count[16], opcode_taken[16];
+
+	std::vector<pc_entry> pcs;			// PROFILE_PC_WAYS ways of every set
+	unsigned char hll[1 << PROFILE_HLL_BITS];
+
+	unsigned long long history;			// outcomes of the last 64 conditional branches
+	std::vector<unsigned char> correlation[PROFILE_LENGTHS];
+	long long int correlation_miss[PROFILE_LENGTHS];
+
+	std::vector<unsigned int> footprint[PROFILE_FOOTPRINTS];	// last PC in every entry, 0 if none
+	long long int footprint_conflicts[PROFILE_FOOTPRINTS];
+
+	long long int window, windows, window_pcs, window_sum, window_max;
+
+	trace_profile (const std::string & f) : fname(f), failed(false), branches(0), untracked(0),
+		pcs((size_t) 1 << PROFILE_PC_BITS), history(0), window(0), windows(0), window_pcs(0), window_sum(0), window_max(0) {
+		memset (flags_count, 0, sizeof (flags_count));
+		memset (opcode_count, 0, sizeof (opcode_count));
+		memset (opcode_taken, 0, sizeof (opcode_taken));
+		memset (hll, 0, sizeof (hll));
+		memset (correlation_miss, 0, sizeof (correlation_miss));
+		memset (footprint_conflicts, 0, sizeof (footprint_conflicts));
+		for (size_t i=0; i<pcs.size (); i++) {
+			pcs[i].pc = 0;
+			pcs[i].window = -1;
+		}
+		for (int l=0; l<PROFILE_LENGTHS; l++) correlation[l].assign ((size_t) 1 << PROFILE_CORRELATION_BITS, 1);
+		for (int f=0; f<PROFILE_FOOTPRINTS; f++) footprint[f].assign ((size_t) 1 << footprint_bits[f], 0);
+	}
+};
+
+static void usage (char *prog) {
+	fprintf (stderr, "Usage: %s [ -j <threads> ] [ -c <cache-dir> ] [ -w <branches> ] [ -o <dir> ] <trace-file-or-directory>...\n", prog);
+	exit (1);
+}
+
+// a 64-bit mix, so that nearby PCs and histories spread over the tables
+
+static inline unsigned long long mix (unsigned long long x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// find the entry of pc, taking a free way of its set if it has none;
+// NULL if the set is full
+
+static pc_entry *find_pc (trace_profile & p, unsigned int pc, unsigned long long h) {
+	size_t set = (h & (((size_t) 1 << PROFILE_PC_BITS) / PROFILE_PC_WAYS - 1)) * PROFILE_PC_WAYS;
+	for (int w=0; w<PROFILE_PC_WAYS; w++) {
+		pc_entry & e = p.pcs[set + w];
+		if (e.pc == pc && e.count) return &e;
+		if (!e.count) {
+			e.pc = pc;
+			return &e;
+		}
+	}
+	return NULL;
+}
+
+// account for one branch
+
+static void profile_branch (trace_profile & p, long long int window_size, trace *t) {
+	unsigned int pc = t->bi.address, flags = t->bi.br_flags & 15;
+	unsigned long long h = mix (pc);
+	p.branches++;
+	p.flags_count[flags]++;
+
+	// the distinct PCs, in the HyperLogLog sketch: every register keeps
+	// the longest run of leading zeros seen among the PCs hashed to it
+
+	unsigned long long rest = h << PROFILE_HLL_BITS | 1ULL << (PROFILE_HLL_BITS - 1);
+	unsigned char rank = __builtin_clzll (rest) + 1;
+	unsigned char & reg = p.hll[h >> (64 - PROFILE_HLL_BITS)];
+	if (rank > reg) reg = rank;
+
+	pc_entry *e = find_pc (p, pc, h);
+	if (e) {
+		e->flags |= flags;
+		e->count++;
+		if (e->window != p.window) {
+			e->window = p.window;
+			p.window_pcs++;
+		}
+	} else
+		p.untracked++;
+
+	// how many entries the branches take in tables indexed by the low
+	// bits of the PC, and how often the last branch in an entry was
+	// a different one
+
+	for (int f=0; f<PROFILE_FOOTPRINTS; f++) {
+		unsigned int & last = p.footprint[f][pc & ((1u << footprint_bits[f]) - 1)];
+		p.footprint_conflicts[f] += last && last != pc;
+		last = pc;
+	}
+
+	if (t->bi.br_flags & BR_CONDITIONAL) {
+		p.opcode_count[t->bi.opcode & 15]++;
+		p.opcode_taken[t->bi.opcode & 15] += t->taken;
+		if (e) {
+			e->conditional++;
+			e->taken += t->taken;
+		}
+
+		// predict the branch from every length of history
+
+		for (int l=0; l<PROFILE_LENGTHS; l++) {
+			int length = correlation_lengths[l];
+			unsigned long long hist = length == 64 ? p.history : p.history & ((1ULL << length) - 1);
+			unsigned long long x = mix (hist * 0x9e3779b97f4a7c15ULL ^ h ^ length);
+			unsigned char & ctr = p.correlation[l][x & ((1ULL << PROFILE_CORRELATION_BITS) - 1)];
+			p.correlation_miss[l] += (ctr >= 2) != t->taken;
+			if (t->taken) {
+				if (ctr < 3) ctr++;
+			} else if (ctr > 0)
+				ctr--;
+		}
+		p.history = p.history << 1 | t->taken;
+	}
+
+	// close the working set window
+
+	if (p.branches % window_size == 0) {
+		p.window_sum += p.window_pcs;
+		p.window_max = std::max (p.window_max, p.window_pcs);
+		p.windows++;
+		p.window++;
+		p.window_pcs = 0;
+	}
+}
+
+static void profile_trace (trace_profile & p, const char *cache_dir, long long int window_size) {
+	trace_reader *tr = open_trace (p.fname.c_str (), cache_dir);
+	if (!tr) {
+		p.failed = true;
+		return;
+	}
+	trace *batch = new trace[1024];
+	for (int m; (m = read_traces (tr, batch, 1024)); )
+		for (int i=0; i<m; i++)
+			profile_branch (p, window_size, &batch[i]);
+	delete[] batch;
+	close_trace (tr);
+}
+
+// the number of distinct PCs from the sketch, with the usual correction
+// for small counts
+
+static double hll_estimate (trace_profile & p) {
+	const int m = 1 << PROFILE_HLL_BITS;
+	double sum = 0;
+	int zeros = 0;
+	for (int i=0; i<m; i++) {
+		sum += ldexp (1.0, -p.hll[i]);
+		zeros += !p.hll[i];
+	}
+	double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if (estimate <= 2.5 * m && zeros) estimate = m * log ((double) m / zeros);
+	return estimate;
+}
+
+static const char *flags_name (int flags, char *buf, size_t n) {
+	static const char *names[4] = { "conditional", "indirect", "call", "return" };
+	buf[0] = 0;
+	for (int b=0; b<4; b++)
+		if (flags & (1 << b)) {
+			if (buf[0]) strncat (buf, "+", n - strlen (buf) - 1);
+			strncat (buf, names[b], n - strlen (buf) - 1);
+		}
+	if (!buf[0]) snprintf (buf, n, "jump");
+	return buf;
+}
+
+static void print_profile (FILE *f, trace_profile & p, long long int window_size) {
+	long long int conditional = 0, taken = 0;
+	for (int o=0; o<16; o++) {
+		conditional += p.opcode_count[o];
+		taken += p.opcode_taken[o];
+	}
+	long long int tracked = 0;
+	long long int bias_static[PROFILE_BIASES] = { 0 }, bias_dynamic[PROFILE_BIASES] = { 0 };
+	for (size_t i=0; i<p.pcs.size (); i++) {
+		pc_entry & e = p.pcs[i];
+		if (!e.count) continue;
+		tracked++;
+		if (!e.conditional) continue;
+		double bias = std::max (e.taken, e.conditional - e.taken) / (double) e.conditional;
+		int b = 0;
+		while (b < PROFILE_BIASES - 1 && bias >= bias_limits[b]) b++;
+		bias_static[b]++;
+		bias_dynamic[b] += e.conditional;
+	}
+
+	fprintf (f, "{\n  \"trace\": ");
+	print_json_string (f, p.fname.c_str ());
+	fprintf (f, ",\n");
+	fprintf (f, "  \"branches\": %lld,\n  \"conditional\": %lld,\n  \"taken_rate\": %0.4f,\n",
+		p.branches, conditional, taken / (double) std::max (conditional, 1LL));
+	fprintf (f, "  \"static_branches\": %lld,\n  \"static_branches_estimate\": %0.0f,\n  \"untracked_branches\": %lld,\n",
+		tracked, hll_estimate (p), p.untracked);
+
+	fprintf (f, "  \"mix\": [");
+	bool first = true;
+	for (int k=0; k<16; k++) {
+		if (!p.flags_count[k]) continue;
+		char name[64];
+		fprintf (f, "%s\n    { \"kind\": \"%s\", \"count\": %lld, \"fraction\": %0.4f }", first ? "" : ",",
+			flags_name (k, name, sizeof (name)), p.flags_count[k], p.flags_count[k] / (double) p.branches);
+		first = false;
+	}
+	fprintf (f, "\n  ],\n  \"opcodes\": [");
+	first = true;
+	for (int o=0; o<16; o++) {
+		if (!p.opcode_count[o]) continue;
+		fprintf (f, "%s\n    { \"opcode\": \"%s\", \"count\": %lld, \"taken_rate\": %0.4f }", first ? "" : ",",
+			opcode_names[o], p.opcode_count[o], p.opcode_taken[o] / (double) p.opcode_count[o]);
+		first = false;
+	}
+	fprintf (f, "\n  ],\n  \"bias\": [");
+	for (int b=0; b<PROFILE_BIASES; b++) {
+		double low = b ? bias_limits[b-1] : 0.5;
+		if (b == PROFILE_BIASES - 1)
+			fprintf (f, "%s\n    { \"bias\": \"1\", ", b ? "," : "");
+		else
+			fprintf (f, "%s\n    { \"bias\": \"%g-%g\", ", b ? "," : "", low, bias_limits[b]);
+		fprintf (f, "\"static\": %lld, \"dynamic_fraction\": %0.4f }", bias_static[b], bias_dynamic[b] / (double) std::max (conditional, 1LL));
+	}
+
+	// the correlation depth is the shortest history that comes within
+	// 5% of the fewest mispredictions of any length
+
+	long long int best = p.correlation_miss[0];
+	for (int l=1; l<PROFILE_LENGTHS; l++) best = std::min (best, p.correlation_miss[l]);
+	int depth = correlation_lengths[PROFILE_LENGTHS - 1];
+	for (int l=PROFILE_LENGTHS-1; l>=0; l--)
+		if (p.correlation_miss[l] <= best * 1.05) depth = correlation_lengths[l];
+	fprintf (f, "\n  ],\n  \"history_correlation\": [");
+	for (int l=0; l<PROFILE_LENGTHS; l++)
+		fprintf (f, "%s\n    { \"length\": %d, \"mispredict_rate\": %0.4f }", l ? "," : "",
+			correlation_lengths[l], p.correlation_miss[l] / (double) std::max (conditional, 1LL));
+	fprintf (f, "\n  ],\n  \"correlation_depth\": %d,\n  \"footprint\": [", depth);
+	for (int k=0; k<PROFILE_FOOTPRINTS; k++) {
+		long long int used = 0;
+		for (size_t i=0; i<p.footprint[k].size (); i++) used += p.footprint[k][i] != 0;
+		fprintf (f, "%s\n    { \"table_bits\": %d, \"entries_used\": %lld, \"conflict_rate\": %0.4f }", k ? "," : "",
+			footprint_bits[k], used, p.footprint_conflicts[k] / (double) std::max (p.branches, 1LL));
+	}
+	fprintf (f, "\n  ],\n  \"working_set\": { \"window\": %lld, \"windows\": %lld, \"average\": %0.1f, \"max\": %lld }\n}",
+		window_size, p.windows, p.window_sum / (double) std::max (p.windows, 1LL), p.window_max);
+}
+
+// one trace and what came of it: its profile as JSON, once the tables
+// it was worked out from are gone
+
+struct profile_job {
+	std::string fname;
+	std::string json;
+	bool failed;
+};
+
+// profile the trace of one job; only the JSON, or nothing with -o, is
+// kept, so only as many trace_profiles as threads are ever alive
+
+static void run_job (profile_job & job, const char *cache_dir, const char *out_dir, long long int window_size) {
+	trace_profile *p = new trace_profile (job.fname);
+	profile_trace (*p, cache_dir, window_size);
+	job.failed = p->failed;
+	if (!job.failed && out_dir) {
+		std::string base = std::filesystem::path (job.fname).filename ().string ();
+		std::string name = std::string (out_dir) + "/" + base.substr (0, base.find (".trace.")) + ".json";
+		FILE *f = fopen (name.c_str (), "w");
+		if (f) {
+			print_profile (f, *p, window_size);
+			fprintf (f, "\n");
+			job.failed = fclose (f) != 0;
+		}
+		if (!f || job.failed) {
+			perror (name.c_str ());
+			job.failed = true;
+		}
+	} else if (!job.failed) {
+		char *buf = NULL;
+		size_t len = 0;
+		FILE *f = open_memstream (&buf, &len);
+		print_profile (f, *p, window_size);
+		fclose (f);
+		job.json.assign (buf, len);
+		free (buf);
+	}
+	delete p;
+}
+
+static void worker (std::vector<profile_job> *jobs, std::atomic<size_t> *next, const char *cache_dir, const char *out_dir, long long int window_size) {
+	for (;;) {
+		size_t i = next->fetch_add (1);
+		if (i >= jobs->size ()) break;
+		run_job ((*jobs)[i], cache_dir, out_dir, window_size);
+	}
+}
+
+int main (int argc, char *argv[]) {
+	std::vector<std::string> traces;
+	const char *cache_dir = getenv ("CBP_TRACE_CACHE");
+	const char *out_dir = NULL;
+	long long int window_size = PROFILE_DEFAULT_WINDOW;
+	int nthreads = std::thread::hardware_concurrency ();
+
+	for (int i=1; i<argc; i++) {
+		if (strcmp (argv[i], "-j") == 0 && i+1 < argc)
+			nthreads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-c") == 0 && i+1 < argc)
+			cache_dir = argv[++i];
+		else if (strcmp (argv[i], "-o") == 0 && i+1 < argc)
+			out_dir = argv[++i];
+		else if (strcmp (argv[i], "-w") == 0 && i+1 < argc)
+			window_size = atoll (argv[++i]);
+		else if (argv[i][0] == '-')
+			usage (argv[0]);
+		else if (std::filesystem::is_directory (argv[i])) {
+
+			// the traces under a directory, as suite finds them
+
+			std::vector<std::string> found;
+			std::error_code ec;
+			for (std::filesystem::recursive_directory_iterator it (argv[i], ec), end; !ec && it != end; it.increment (ec))
+				if (it->is_regular_file () && it->path ().filename ().string ().find (".trace.") != std::string::npos)
+					found.push_back (it->path ().string ());
+			if (ec) {
+				fprintf (stderr, "%s: %s\n", argv[i], ec.message ().c_str ());
+				exit (1);
+			}
+			std::sort (found.begin (), found.end ());
+			traces.insert (traces.end (), found.begin (), found.end ());
+		} else
+			traces.push_back (argv[i]);
+	}
+	if (traces.empty () || window_size < 1) usage (argv[0]);
+	if (nthreads < 1) nthreads = 1;
+
+	std::vector<profile_job> jobs (traces.size ());
+	for (size_t i=0; i<traces.size (); i++)
+		jobs[i].fname = traces[i];
+	std::atomic<size_t> next (0);
+	std::vector<std::thread> pool;
+	for (int i=0; i<nthreads && i<(int) jobs.size (); i++)
+		pool.push_back (std::thread (worker, &jobs, &next, cache_dir, out_dir, window_size));
+	for (size_t i=0; i<pool.size (); i++)
+		pool[i].join ();
+
+	int failures = 0;
+	bool first = true;
+	if (!out_dir) printf ("[\n");
+	for (size_t i=0; i<jobs.size (); i++) {
+		if (jobs[i].failed) {
+			failures++;
+			continue;
+		}
+		if (!out_dir) {
+			if (!first) printf (",\n");
+			fputs (jobs[i].json.c_str (), stdout);
+			first = false;
+		}
+	}
+	if (!out_dir) printf ("\n]\n");
+	exit (failures ? 1 : 0);
+}
@@ -0,0 +1,270 @@
+// sample.h
+// This file contains two ways to estimate the MPKI of predictors on a
+// trace from a fraction of it, for quick design iteration.
+//
+// Periodic sampling: in every period of P traces, the last W+M traces
+// are simulated, the first W of them only to warm the predictors up and
+// the last M to count mispredictions; the rest are skipped without being
+// simulated.  The MPKI comes with a 95% confidence interval from the
+// spread of the miss rates of the samples.
+//
+// Representative intervals (as in SimPoint): the trace is cut into
+// intervals, and the intervals are clustered with k-means on their
+// basic-branch vectors, i.e. how often each branch address occurs,
+// hashed into BBV_DIMS buckets.  Only the interval nearest the middle of
+// each cluster is simulated, after W traces of warm-up, and its miss
+// rate stands for the whole cluster.
+//
+// Skipping traces is cheapest on chunked and cached traces, which seek
+// straight to the next sample; other traces still have to be decoded.
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// each trace represents exactly 100 million instructions
+
+#define TRACE_KILO_INSTRUCTIONS	1e5
+
+// number of buckets in a basic-branch vector, and k-means iterations
+
+#define BBV_DIMS	64
+#define KMEANS_ROUNDS	50
+
+// an estimated MPKI for one predictor
+
+struct mpki_estimate {
+	double mpki;
+	double ci;		// half-width of the 95% confidence interval; 0 if there isn't one
+	int samples;		// number of samples or intervals simulated
+};
+
+// skip up to n traces without simulating them; returns how many were skipped
+
+static long long int skip_traces (trace_reader *tr, long long int pos, long long int n, trace *batch) {
+	long long int total = trace_count (tr);
+	if (total >= 0) {
+		if (pos + n > total) n = total - pos;
+		seek_trace (tr, pos + n);
+		return n;
+	}
+	long long int done = 0;
+	while (done < n) {
+		long long int m = read_traces (tr, batch, std::min (n - done, (long long int) RING_BATCH));
+		if (!m) break;
+		done += m;
+	}
+	return done;
+}
+
+// estimate MPKI by periodic sampling; returns the number of traces in
+// the file
+
+long long int simulate_sampled (trace_reader *tr, std::vector<predictor_run> & runs,
+	long long int period, long long int warmup, long long int measure, std::vector<mpki_estimate> & est) {
+	trace *batch = new trace[RING_BATCH];
+	std::vector<std::vector<double> > rates (runs.size ());
+	std::vector<long long int> before (runs.size ());
+	long long int pos = 0, skip = period - warmup - measure;
+
+	for (;;) {
+		long long int n = skip_traces (tr, pos, skip, batch);
+		pos += n;
+		if (n < skip) break;
+		n = simulate_window (tr, runs, warmup, batch);
+		pos += n;
+		if (n < warmup) break;
+		for (size_t i=0; i<runs.size (); i++) before[i] = runs[i].dmiss;
+		n = simulate_window (tr, runs, measure, batch);
+		pos += n;
+
+		// a sample cut short by the end of the trace doesn't count
+
+		if (n < measure) break;
+		for (size_t i=0; i<runs.size (); i++)
+			rates[i].push_back ((runs[i].dmiss - before[i]) / (double) measure);
+	}
+	delete[] batch;
+
+	// scale the mean miss rate up to the whole trace
+
+	est.resize (runs.size ());
+	for (size_t i=0; i<runs.size (); i++) {
+		std::vector<double> & r = rates[i];
+		double sum = 0, sumsq = 0;
+		for (size_t j=0; j<r.size (); j++) {
+			sum += r[j];
+			sumsq += r[j] * r[j];
+		}
+		int k = r.size ();
+		double mean = k ? sum / k : 0;
+		double var = k > 1 ? (sumsq - k * mean * mean) / (k - 1) : 0;
+		est[i].mpki = mean * pos / TRACE_KILO_INSTRUCTIONS;
+		est[i].ci = k > 1 ? 1.96 * sqrt (std::max (var, 0.0) / k) * pos / TRACE_KILO_INSTRUCTIONS : 0;
+		est[i].samples = k;
+	}
+	return pos;
+}
+
+// squared distance between two basic-branch vectors
+
+static double bbv_distance (const double *a, const double *b) {
+	double d = 0;
+	for (int i=0; i<BBV_DIMS; i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+	return d;
+}
+
+// cluster the n vectors in bbv into k clusters; returns the cluster of
+// each vector, and leaves the middle of each cluster in centers
+
+static std::vector<int> kmeans (const std::vector<double> & bbv, int n, int k, std::vector<double> & centers) {
+	std::vector<double> dist (n);
+	std::vector<int> cluster (n, 0), size (k);
+	unsigned int seed = 1;
+
+	// k-means++: each new center is a vector picked with probability
+	// proportional to its squared distance from the nearest center so
+	// far; a fixed seed keeps the choice the same from run to run
+
+	centers.assign (k * BBV_DIMS, 0.0);
+	std::copy (&bbv[0], &bbv[BBV_DIMS], &centers[0]);
+	for (int i=0; i<n; i++) dist[i] = bbv_distance (&bbv[i * BBV_DIMS], &centers[0]);
+	for (int c=1; c<k; c++) {
+		double sum = 0;
+		for (int i=0; i<n; i++) sum += dist[i];
+		seed = seed * 1103515245 + 12345;
+		double x = sum * ((seed >> 8) / (double) (1 << 24));
+		int pick = n - 1;
+		for (int i=0; i<n; i++) {
+			x -= dist[i];
+			if (x < 0) {
+				pick = i;
+				break;
+			}
+		}
+		std::copy (&bbv[pick * BBV_DIMS], &bbv[(pick+1) * BBV_DIMS], &centers[c * BBV_DIMS]);
+		for (int i=0; i<n; i++)
+			dist[i] = std::min (dist[i], bbv_distance (&bbv[i * BBV_DIMS], &centers[c * BBV_DIMS]));
+	}
+
+	for (int round=0; round<KMEANS_ROUNDS; round++) {
+
+		// assign every vector to its nearest center
+
+		bool moved = false;
+		for (int i=0; i<n; i++) {
+			int best = 0;
+			double bestd = bbv_distance (&bbv[i * BBV_DIMS], &centers[0]);
+			for (int c=1; c<k; c++) {
+				double d = bbv_distance (&bbv[i * BBV_DIMS], &centers[c * BBV_DIMS]);
+				if (d < bestd) {
+					bestd = d;
+					best = c;
+				}
+			}
+			if (best != cluster[i]) moved = true;
+			cluster[i] = best;
+		}
+		if (round && !moved) break;
+
+		// move every center to the middle of its cluster
+
+		std::fill (centers.begin (), centers.end (), 0.0);
+		std::fill (size.begin (), size.end (), 0);
+		for (int i=0; i<n; i++) {
+			size[cluster[i]]++;
+			for (int d=0; d<BBV_DIMS; d++) centers[cluster[i] * BBV_DIMS + d] += bbv[i * BBV_DIMS + d];
+		}
+		for (int c=0; c<k; c++)
+			for (int d=0; d<BBV_DIMS && size[c]; d++) centers[c * BBV_DIMS + d] /= size[c];
+	}
+	return cluster;
+}
+
+// estimate MPKI from representative intervals of the trace in fname;
+// returns the number of traces in the file
+
+long long int simulate_simpoints (const char *fname, const char *cache_dir, std::vector<predictor_run> & runs,
+	long long int interval, int k, long long int warmup, std::vector<mpki_estimate> & est) {
+	trace *batch = new trace[RING_BATCH];
+	std::vector<double> bbv;
+	long long int pos = 0;
+
+	// first pass: the basic-branch vector of every whole interval
+
+	trace_reader *tr = open_trace (fname, cache_dir);
+	if (!tr) exit (1);
+	int n = 0;
+	std::vector<double> v (BBV_DIMS);
+	for (;;) {
+		int m = read_traces (tr, batch, RING_BATCH);
+		if (!m) break;
+		for (int j=0; j<m; j++) {
+			v[(batch[j].bi.address * 2654435761u) >> 26]++;
+			if (++pos % interval == 0) {
+
+				// normalize so intervals compare by mix, not length
+
+				for (int d=0; d<BBV_DIMS; d++) bbv.push_back (v[d] / interval);
+				std::fill (v.begin (), v.end (), 0.0);
+				n++;
+			}
+		}
+	}
+	close_trace (tr);
+	if (n == 0) {
+		fprintf (stderr, "%s: shorter than one interval\n", fname);
+		exit (1);
+	}
+	long long int total = pos;
+
+	// cluster the intervals and pick the one nearest each center
+
+	if (k > n) k = n;
+	std::vector<double> centers;
+	std::vector<int> cluster = kmeans (bbv, n, k, centers);
+	std::vector<int> rep (k, -1), size (k, 0);
+	std::vector<double> repd (k);
+	for (int i=0; i<n; i++) {
+		int c = cluster[i];
+		double d = bbv_distance (&bbv[i * BBV_DIMS], &centers[c * BBV_DIMS]);
+		size[c]++;
+		if (rep[c] < 0 || d < repd[c]) {
+			rep[c] = i;
+			repd[c] = d;
+		}
+	}
+	std::vector<std::pair<int, int> > picks;	// (interval, cluster) in trace order
+	for (int c=0; c<k; c++)
+		if (rep[c] >= 0) picks.push_back (std::make_pair (rep[c], c));
+	std::sort (picks.begin (), picks.end ());
+
+	// second pass: simulate the picked intervals, each after its warm-up
+
+	std::vector<double> mpki (runs.size (), 0.0);
+	std::vector<long long int> before (runs.size ());
+	tr = open_trace (fname, cache_dir);
+	if (!tr) exit (1);
+	pos = 0;
+	for (size_t p=0; p<picks.size (); p++) {
+		long long int start = picks[p].first * interval;
+		long long int from = std::max (pos, start - warmup);
+		pos += skip_traces (tr, pos, from - pos, batch);
+		pos += simulate_window (tr, runs, start - pos, batch);
+		for (size_t i=0; i<runs.size (); i++) before[i] = runs[i].dmiss;
+		pos += simulate_window (tr, runs, interval, batch);
+		double weight = size[picks[p].second] / (double) n;
+		for (size_t i=0; i<runs.size (); i++)
+			mpki[i] += weight * (runs[i].dmiss - before[i]) / (double) interval;
+	}
+	close_trace (tr);
+	delete[] batch;
+
+	est.resize (runs.size ());
+	for (size_t i=0; i<runs.size (); i++) {
+		est[i].mpki = mpki[i] * total / TRACE_KILO_INSTRUCTIONS;
+		est[i].ci = 0;
+		est[i].samples = picks.size ();
+	}
+	return total;
+}
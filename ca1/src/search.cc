@@ -0,0 +1,335 @@
+// search.cc
+// This file contains the main function of the geometry search.  It
+// takes a fixed grid of predictor geometries (TAGE with and without the
+// loop predictor and statistical corrector, gshare and the perceptron),
+// keeps those whose storage (see storage_bits in each predictor) fits in
+// a budget, and simulates them on a sample of the traces under a
+// directory with a pool of threads.  It prints every geometry with its
+// storage, its average MPKI over the sample and the branches it
+// simulated per second, and marks those on the Pareto front of MPKI
+// against storage and of MPKI against speed: no other geometry is as
+// small (or as fast) and as accurate, and better at one of the two.
+//
+// "-b <bytes>" is the budget, by default the 32 KB of CBP-2.  "-n
+// <traces>" samples that many trace files, spread evenly over them in
+// name order (0 for all), and "-e <branches>" simulates only the first
+// that many branches of each (0 for all), scaling the misses up to the
+// whole trace.  "-j <threads>", "-c <cache-dir>" and "-x <seed>" are as
+// for suite, "-f csv | text" picks the output, and "-l" lists the
+// geometries that fit without simulating them.
+//
+// The grid is 96 TAGE geometries, 6 gshare and 12 perceptron; 79 of them
+// fit the default budget.  Each is its own template instantiation, so
+// this takes minutes to compile and is not built by "make all".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+#include "my_predictor.h"
+#include "gshare.h"
+#include "perceptron.h"
+#include "presets.h"
+#include "simulate.h"
+
+// one geometry and how it did over the sample
+
+struct search_candidate {
+	std::string name;
+	long long int storage_bits;
+	branch_predictor *(*make) (bool stats);
+	double mpki;			// sum over the sampled traces, then the average
+	long long int branches;		// branches simulated
+	double seconds;			// time spent in the predictor
+	bool size_front, speed_front;	// on the Pareto fronts
+};
+
+// TAGE geometries of the grid.  the ratio between history lengths is
+// chosen so that the longest history stays near the ~270 branches of
+// the default five components whatever the number of components.
+
+template <int C, int I, int T, bool SCL>
+struct SearchTageConfig : TageConfig<C, I, T> {
+	static constexpr double HISTORY_ALPHA = C <= 4 ? 3.8 : C == 5 ? 2.71828182846 : C == 6 ? 2.23 : C == 7 ? 1.95 : 1.77;
+	static constexpr bool LOOP_PREDICTOR = SCL;
+	static constexpr bool STATISTICAL_CORRECTOR = SCL;
+};
+
+template <class P>
+static void add_candidate (std::vector<search_candidate> & v, const char *fmt, int a, int b = 0, int c = 0) {
+	char name[64];
+	snprintf (name, sizeof (name), fmt, a, b, c);
+	v.push_back (search_candidate { name, P::storage_bits (), make_preset<P>, 0, 0, 0, false, false });
+}
+
+template <int C, int I, int T>
+static void add_tage (std::vector<search_candidate> & v) {
+	add_candidate<my_predictor<SearchTageConfig<C, I, T, false> > > (v, "tage-%dx%dx%d", C, I, T);
+	add_candidate<my_predictor<SearchTageConfig<C, I, T, true> > > (v, "tage-sc-l-%dx%dx%d", C, I, T);
+}
+
+template <int C, int I, int... T>
+static void add_tage_tags (std::vector<search_candidate> & v) {
+	(add_tage<C, I, T> (v), ...);
+}
+
+template <int C, int... I>
+static void add_tage_indices (std::vector<search_candidate> & v) {
+	(add_tage_tags<C, I, 8, 10, 12> (v), ...);
+}
+
+template <int... C>
+static void add_tages (std::vector<search_candidate> & v) {
+	(add_tage_indices<C, 9, 10, 11, 12> (v), ...);
+}
+
+template <int... B>
+static void add_gshares (std::vector<search_candidate> & v) {
+	(add_candidate<gshare_predictor<B, B> > (v, "gshare-%d", B), ...);
+}
+
+template <int H, int... R>
+static void add_perceptrons (std::vector<search_candidate> & v) {
+	(add_candidate<perceptron_predictor<H, R> > (v, "perceptron-%dx%d", H, R), ...);
+}
+
+// the whole grid: the names give the components, index and tag bits of
+// TAGE, the table bits of gshare, and the history length and row bits of
+// the perceptron
+
+static std::vector<search_candidate> search_grid (void) {
+	std::vector<search_candidate> v;
+	add_tages<4, 5, 6, 8> (v);
+	add_gshares<12, 13, 14, 15, 16, 17> (v);
+	add_perceptrons<15, 7, 8, 9, 10> (v);
+	add_perceptrons<31, 7, 8, 9, 10> (v);
+	add_perceptrons<63, 7, 8, 9, 10> (v);
+	return v;
+}
+
+// a block of candidates simulated on one trace; blocks rather than the
+// whole grid per trace so that a small sample still keeps every thread
+// busy, and rather than one candidate so the trace isn't decoded once
+// for every candidate
+
+#define SEARCH_BLOCK	8
+
+struct search_job {
+	const char *fname;
+	size_t first, last;		// candidates [first, last)
+	std::vector<predictor_run> runs;
+	long long int branches;		// simulated
+	long long int total;		// in the whole trace
+	bool failed;
+};
+
+static void usage (char *prog) {
+	fprintf (stderr, "Usage: %s [ -b <bytes> ] [ -n <traces> ] [ -e <branches> ] [ -j <threads> ] [ -c <cache-dir> ] [ -x <seed> ] [ -f csv | text ] <trace-directory>\n", prog);
+	fprintf (stderr, "       %s [ -b <bytes> ] -l\n", prog);
+	exit (1);
+}
+
+static void run_job (search_job & job, std::vector<search_candidate> & grid, long long int limit, const char *cache_dir, long long int seed) {
+	for (size_t i=job.first; i<job.last; i++) {
+		job.runs.push_back (predictor_run (grid[i].name.c_str (), grid[i].make (false)));
+		if (seed >= 0) job.runs.back ().p->seed (seed);
+	}
+	trace_reader *tr = open_trace (job.fname, cache_dir);
+	if (!tr) {
+		job.failed = true;
+	} else {
+		trace *batch = new trace[RING_BATCH];
+		job.branches = simulate_window (tr, job.runs, limit ? limit : LLONG_MAX, batch);
+
+		// the length of the trace, to scale the misses by; read on to
+		// the end if the trace can't tell
+
+		job.total = trace_count (tr);
+		if (job.total < 0) {
+			job.total = job.branches;
+			for (int m; (m = read_traces (tr, batch, RING_BATCH)); ) job.total += m;
+		}
+		delete[] batch;
+		close_trace (tr);
+	}
+	for (size_t i=0; i<job.runs.size (); i++) {
+		delete job.runs[i].p;
+		job.runs[i].p = NULL;
+	}
+}
+
+static void worker (std::vector<search_job> *jobs, std::atomic<size_t> *next, std::vector<search_candidate> *grid,
+	long long int limit, const char *cache_dir, long long int seed) {
+	for (;;) {
+		size_t i = next->fetch_add (1);
+		if (i >= jobs->size ()) break;
+		run_job ((*jobs)[i], *grid, limit, cache_dir, seed);
+	}
+}
+
+static bool by_storage (const search_candidate & a, const search_candidate & b) {
+	if (a.storage_bits != b.storage_bits) return a.storage_bits < b.storage_bits;
+	return a.name < b.name;
+}
+
+// mark the candidates no other candidate beats in MPKI and in storage,
+// and those none beats in MPKI and in speed
+
+static void pareto_fronts (std::vector<search_candidate> & c) {
+	for (size_t i=0; i<c.size (); i++) {
+		double speed_i = c[i].branches / std::max (c[i].seconds, 1e-9);
+		c[i].size_front = c[i].speed_front = true;
+		for (size_t j=0; j<c.size (); j++) {
+			if (i == j) continue;
+			double speed_j = c[j].branches / std::max (c[j].seconds, 1e-9);
+			if (c[j].mpki <= c[i].mpki && c[j].storage_bits <= c[i].storage_bits
+			 && (c[j].mpki < c[i].mpki || c[j].storage_bits < c[i].storage_bits))
+				c[i].size_front = false;
+			if (c[j].mpki <= c[i].mpki && speed_j >= speed_i
+			 && (c[j].mpki < c[i].mpki || speed_j > speed_i))
+				c[i].speed_front = false;
+		}
+	}
+}
+
+int main (int argc, char *argv[]) {
+	long long int budget = 32768, limit = 10000000, seed = -1;
+	int ntraces = 6;
+	const char *format = "text";
+	char *dir = NULL;
+	const char *cache_dir = getenv ("CBP_TRACE_CACHE");
+	int nthreads = std::thread::hardware_concurrency ();
+	bool list = false;
+
+	for (int i=1; i<argc; i++) {
+		if (strcmp (argv[i], "-b") == 0 && i+1 < argc)
+			budget = atoll (argv[++i]);
+		else if (strcmp (argv[i], "-n") == 0 && i+1 < argc)
+			ntraces = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-e") == 0 && i+1 < argc)
+			limit = atoll (argv[++i]);
+		else if (strcmp (argv[i], "-j") == 0 && i+1 < argc)
+			nthreads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-c") == 0 && i+1 < argc)
+			cache_dir = argv[++i];
+		else if (strcmp (argv[i], "-f") == 0 && i+1 < argc)
+			format = argv[++i];
+		else if (strcmp (argv[i], "-x") == 0 && i+1 < argc) {
+			seed = atoll (argv[++i]);
+			if (seed < 0 || seed > 0xffffffffLL) usage (argv[0]);
+		} else if (strcmp (argv[i], "-l") == 0)
+			list = true;
+		else if (argv[i][0] != '-' && !dir)
+			dir = argv[i];
+		else
+			usage (argv[0]);
+	}
+	if (budget <= 0 || ntraces < 0 || limit < 0) usage (argv[0]);
+	if (strcmp (format, "csv") && strcmp (format, "text")) usage (argv[0]);
+	if (nthreads < 1) nthreads = 1;
+
+	// the geometries that fit, smallest first
+
+	std::vector<search_candidate> grid = search_grid ();
+	grid.erase (std::remove_if (grid.begin (), grid.end (),
+		[budget] (const search_candidate & c) { return c.storage_bits > budget * 8; }), grid.end ());
+	std::sort (grid.begin (), grid.end (), by_storage);
+	if (grid.empty ()) {
+		fprintf (stderr, "%s: no geometry fits in %lld bytes\n", argv[0], budget);
+		exit (1);
+	}
+	if (list) {
+		for (size_t i=0; i<grid.size (); i++)
+			printf ("%-24s%9.2f KB\n", grid[i].name.c_str (), grid[i].storage_bits / 8192.0);
+		exit (0);
+	}
+	if (!dir) usage (argv[0]);
+
+	// find the traces as suite does, and take an evenly spread sample
+
+	std::vector<std::string> traces;
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it (dir, ec), end; !ec && it != end; it.increment (ec))
+		if (it->is_regular_file () && it->path ().filename ().string ().find (".trace.") != std::string::npos)
+			traces.push_back (it->path ().string ());
+	if (ec) {
+		fprintf (stderr, "%s: %s\n", dir, ec.message ().c_str ());
+		exit (1);
+	}
+	if (traces.empty ()) {
+		fprintf (stderr, "%s: no traces found\n", dir);
+		exit (1);
+	}
+	std::sort (traces.begin (), traces.end ());
+	if (ntraces && ntraces < (int) traces.size ()) {
+		std::vector<std::string> sample;
+		for (int k=0; k<ntraces; k++)
+			sample.push_back (traces[(2 * k + 1) * traces.size () / (2 * ntraces)]);
+		traces = sample;
+	}
+
+	std::vector<search_job> jobs;
+	for (size_t t=0; t<traces.size (); t++)
+		for (size_t first=0; first<grid.size (); first+=SEARCH_BLOCK) {
+			search_job job;
+			job.fname = traces[t].c_str ();
+			job.first = first;
+			job.last = std::min (first + SEARCH_BLOCK, grid.size ());
+			job.branches = job.total = 0;
+			job.failed = false;
+			jobs.push_back (job);
+		}
+	fprintf (stderr, "%d geometries within %lld bytes on %d traces\n", (int) grid.size (), budget, (int) traces.size ());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	std::atomic<size_t> next (0);
+	std::vector<std::thread> pool;
+	for (int i=0; i<nthreads && i<(int) jobs.size (); i++)
+		pool.push_back (std::thread (worker, &jobs, &next, &grid, limit, cache_dir, seed));
+	for (size_t i=0; i<pool.size (); i++)
+		pool[i].join ();
+	std::chrono::duration<double> total = std::chrono::steady_clock::now () - start;
+
+	// average the MPKI over the traces, scaling the misses in the
+	// simulated part up to the whole trace of 100 million instructions
+
+	for (size_t i=0; i<jobs.size (); i++) {
+		search_job & job = jobs[i];
+		if (job.failed || !job.branches) {
+			fprintf (stderr, "%s: can't simulate\n", job.fname);
+			exit (1);
+		}
+		for (size_t k=0; k<job.runs.size (); k++) {
+			search_candidate & c = grid[job.first + k];
+			c.mpki += 1000.0 * (job.runs[k].dmiss / 1e8) * job.total / job.branches / traces.size ();
+			c.branches += job.branches;
+			c.seconds += job.runs[k].seconds;
+		}
+	}
+	pareto_fronts (grid);
+
+	if (strcmp (format, "csv") == 0) {
+		printf ("geometry,storage_bytes,mpki,branches_per_sec,storage_front,speed_front\n");
+		for (size_t i=0; i<grid.size (); i++)
+			printf ("%s,%0.0f,%0.3f,%0.0f,%d,%d\n", grid[i].name.c_str (), grid[i].storage_bits / 8.0, grid[i].mpki,
+				grid[i].branches / grid[i].seconds, grid[i].size_front, grid[i].speed_front);
+	} else {
+		printf ("%-24s%12s%10s%14s  %s\n", "geometry", "storage", "MPKI", "branches/s", "Pareto front");
+		for (size_t i=0; i<grid.size (); i++)
+			printf ("%-24s%9.2f KB%10.3f%14.0f  %s%s\n", grid[i].name.c_str (), grid[i].storage_bits / 8192.0, grid[i].mpki,
+				grid[i].branches / grid[i].seconds, grid[i].size_front ? "storage " : "", grid[i].speed_front ? "speed" : "");
+	}
+	fprintf (stderr, "%d geometries on %d traces on %d threads in %0.3f seconds\n",
+		(int) grid.size (), (int) traces.size (), (int) pool.size (), total.count ());
+	exit (0);
+}
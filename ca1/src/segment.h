@@ -0,0 +1,94 @@
+// segment.h
+// This file simulates one trace as several segments at once, each on its
+// own thread.  The predictors of a segment start cold and are warmed up
+// on the W traces just before it, which are simulated but not counted;
+// the misses counted in every segment are then added up.  The warm-up
+// only approximates the state a serial run would have reached by then,
+// so the total can differ a little from the serial one; simulating the
+// trace serially as well shows by how much, to help choose W.
+//
+// Every thread seeks to its own segment, so the trace has to be chunked
+// or cached (see trace.cc).
+
+#include <thread>
+#include <vector>
+
+// one segment on its way through a thread
+
+struct segment_job {
+	const char *fname, *cache_dir;
+	long long int from;		// first trace simulated, for warm-up
+	long long int start, end;	// traces whose misses count
+	std::vector<predictor_run> runs;
+	bool ok;
+};
+
+static void simulate_segment (segment_job *j) {
+	trace_reader *tr = open_trace (j->fname, j->cache_dir);
+	j->ok = tr && seek_trace (tr, j->from);
+	if (!j->ok) {
+		if (tr) close_trace (tr);
+		return;
+	}
+	trace *batch = new trace[RING_BATCH];
+	simulate_window (tr, j->runs, j->start - j->from, batch);
+	for (size_t i=0; i<j->runs.size (); i++)
+		j->runs[i].tmiss = j->runs[i].dmiss = 0;
+	j->ok = simulate_window (tr, j->runs, j->end - j->start, batch) == j->end - j->start;
+	delete[] batch;
+	close_trace (tr);
+}
+
+// simulate the trace in fname as nsegments segments on their own threads
+// with warmup traces of warm-up each, adding the misses to runs; the
+// predictors of every segment are seeded with seed unless it is -1.
+// returns the number of traces, or -1 if the trace can't seek
+
+long long int simulate_segments (const char *fname, const char *cache_dir, std::vector<predictor_run> & runs,
+	int nsegments, long long int warmup, long long int seed = -1) {
+
+	// open the trace once first, so that a missing cache is only
+	// filled once rather than by every thread
+
+	trace_reader *tr = open_trace (fname, cache_dir);
+	if (!tr) exit (1);
+	long long int total = trace_count (tr);
+	close_trace (tr);
+	if (total < 0) return -1;
+
+	std::vector<segment_job> jobs (nsegments);
+	for (int k=0; k<nsegments; k++) {
+		segment_job & j = jobs[k];
+		j.fname = fname;
+		j.cache_dir = cache_dir;
+		j.start = total * k / nsegments;
+		j.end = total * (k+1) / nsegments;
+		j.from = std::max (0LL, j.start - warmup);
+		for (size_t i=0; i<runs.size (); i++) {
+			j.runs.push_back (predictor_run (runs[i].name, make_predictor (runs[i].name)));
+			if (seed >= 0) j.runs.back ().p->seed (seed);
+		}
+	}
+	std::vector<std::thread> pool;
+	for (int k=0; k<nsegments; k++)
+		pool.push_back (std::thread (simulate_segment, &jobs[k]));
+	for (int k=0; k<nsegments; k++)
+		pool[k].join ();
+
+	// merge the segments
+
+	for (int k=0; k<nsegments; k++) {
+		segment_job & j = jobs[k];
+		if (!j.ok) {
+			fprintf (stderr, "%s: can't simulate traces %lld to %lld\n", fname, j.start, j.end);
+			exit (1);
+		}
+		for (size_t i=0; i<runs.size (); i++) {
+			runs[i].tmiss += j.runs[i].tmiss;
+			runs[i].dmiss += j.runs[i].dmiss;
+			runs[i].seconds += j.runs[i].seconds;
+			delete j.runs[i].p;
+		}
+	}
+	return total;
+}
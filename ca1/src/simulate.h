@@ -0,0 +1,175 @@
+// simulate.h
+// This file contains the loop that feeds the traces of one trace file to
+// any number of branch predictors.  The trace is decoded once and every
+// record goes to every predictor, either in turn on the calling thread
+// or, with threads, through a ring of decoded records that each predictor
+// thread consumes at its own pace.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// one predictor being simulated and the statistics kept for it
+
+struct predictor_run {
+	const char *name;	// preset the predictor was built from
+	branch_predictor *p;
+	long long int 
+		tmiss, 		// number of target mispredictions
+		dmiss; 		// number of direction mispredictions
+	double seconds;		// time spent in the predictor, for its throughput
+	bool targets;		// p predicts targets, so tmiss means something; kept after p is gone
+
+	predictor_run (const char *n, branch_predictor *bp) :
+		name(n), p(bp), tmiss(0), dmiss(0), seconds(0), targets(bp && bp->predicts_targets ()) {}
+};
+
+// send one trace to one predictor and collect statistics: a direction
+// misprediction for a conditional branch, and a target misprediction
+// for any branch that is taken.  a predictor that predicts no targets
+// misses the target of every taken branch.
+
+static inline void simulate_trace (predictor_run & r, trace *t) {
+	branch_update *u = r.p->predict (t->bi);
+
+	// count a direction misprediction
+
+	if (t->bi.br_flags & BR_CONDITIONAL)
+		r.dmiss += u->direction_prediction () != t->taken;
+
+	// count a target misprediction
+
+	r.tmiss += t->taken & (u->target_prediction () != t->target);
+
+	// update competitor's state
+
+	r.p->update (u, t->taken, t->target);
+}
+
+// simulate a batch of traces on one predictor, timing it.  a batch is
+// long enough that reading the clock twice doesn't show.
+
+static void simulate_batch (predictor_run & r, trace *ts, int n) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (int j=0; j<n; j++)
+		simulate_trace (r, &ts[j]);
+	std::chrono::duration<double> d = std::chrono::steady_clock::now () - start;
+	r.seconds += d.count ();
+}
+
+// a single-producer, multiple-consumer ring of traces.  the decoder
+// publishes records in batches by advancing head; every consumer owns
+// a tail and the decoder never overwrites a record the slowest consumer
+// has not seen yet.
+
+#define RING_SIZE	(1 << 16)
+#define RING_BATCH	1024
+
+struct trace_ring {
+	trace records[RING_SIZE];
+	std::atomic<unsigned long long> head;		// records published so far
+	std::atomic<bool> done;				// no more records will be published
+	std::vector<std::atomic<unsigned long long> > tails;	// records each consumer is done with
+
+	trace_ring (int consumers) : head(0), done(false), tails(consumers) {
+		for (int i=0; i<consumers; i++) tails[i].store (0);
+	}
+
+	unsigned long long slowest_tail (void) {
+		unsigned long long m = tails[0].load (std::memory_order_acquire);
+		for (size_t i=1; i<tails.size (); i++) {
+			unsigned long long t = tails[i].load (std::memory_order_acquire);
+			if (t < m) m = t;
+		}
+		return m;
+	}
+};
+
+// consume the ring on behalf of consumer i until the decoder is done
+
+static void ring_consumer (trace_ring *ring, int i, predictor_run *r) {
+	unsigned long long tail = 0;
+	for (;;) {
+		unsigned long long head = ring->head.load (std::memory_order_acquire);
+		if (tail == head) {
+			if (ring->done.load (std::memory_order_acquire)
+			 && tail == ring->head.load (std::memory_order_acquire)) break;
+			std::this_thread::yield ();
+			continue;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+		for (; tail < head; tail++)
+			simulate_trace (*r, &ring->records[tail & (RING_SIZE-1)]);
+		std::chrono::duration<double> d = std::chrono::steady_clock::now () - start;
+		r->seconds += d.count ();
+		ring->tails[i].store (tail, std::memory_order_release);
+	}
+}
+
+// simulate up to n traces on every predictor; returns how many were read
+
+long long int simulate_window (trace_reader *tr, std::vector<predictor_run> & runs, long long int n, trace *batch) {
+	long long int done = 0;
+	while (done < n) {
+		int m = read_traces (tr, batch, std::min (n - done, (long long int) RING_BATCH));
+		if (!m) break;
+		for (size_t i=0; i<runs.size (); i++)
+			simulate_batch (runs[i], batch, m);
+		done += m;
+	}
+	return done;
+}
+
+// feed every trace from tr to every predictor in runs; returns the
+// number of traces read
+
+long long int simulate (trace_reader *tr, std::vector<predictor_run> & runs, bool threaded) {
+	long long int n = 0;
+
+	if (!threaded || runs.size () < 2) {
+		trace *batch = new trace[RING_BATCH];
+		for (;;) {
+			int m = read_traces (tr, batch, RING_BATCH);
+
+			// nothing read means end of file
+
+			if (!m) break;
+			n += m;
+			for (size_t i=0; i<runs.size (); i++)
+				simulate_batch (runs[i], batch, m);
+		}
+		delete[] batch;
+		return n;
+	}
+
+	trace_ring *ring = new trace_ring (runs.size ());
+	std::vector<std::thread> consumers;
+	for (size_t i=0; i<runs.size (); i++)
+		consumers.push_back (std::thread (ring_consumer, ring, (int) i, &runs[i]));
+
+	// decode straight into the ring, a batch at a time.  RING_SIZE is a
+	// multiple of RING_BATCH, so a batch never wraps around the ring.
+
+	unsigned long long head = 0, limit = RING_SIZE;
+	for (;;) {
+
+		// wait for the slowest consumer to make room
+
+		while (limit - head < RING_BATCH) {
+			limit = ring->slowest_tail () + RING_SIZE;
+			if (limit - head < RING_BATCH) std::this_thread::yield ();
+		}
+		int m = read_traces (tr, &ring->records[head & (RING_SIZE-1)], RING_BATCH);
+		if (!m) break;
+		head += m;
+		ring->head.store (head, std::memory_order_release);
+	}
+	ring->head.store (head, std::memory_order_release);
+	ring->done.store (true, std::memory_order_release);
+	for (size_t i=0; i<consumers.size (); i++)
+		consumers[i].join ();
+	delete ring;
+	return head;
+}
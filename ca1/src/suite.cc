@@ -0,0 +1,245 @@
+// suite.cc
+// This file contains the main function of the suite runner, which does
+// the job of the ../run script in one process.  It finds every trace
+// file under a directory, and runs the chosen predictor presets on
+// them with a pool of threads, taking the longest traces (by file size)
+// first so the suite finishes close to the time of its longest trace.
+// It prints, for every trace and preset, the MPKI (and, as CSV or JSON,
+// the target MPKI of presets that predict targets; see simulate.h), the
+// wall time taken by the trace and the branches simulated per second,
+// and the time spent in that preset's predictor alone and its branches
+// per second, as CSV, JSON, or the text the run script printed.  Like
+// predict, it reads traces through the cache in "-c <dir>" or
+// $CBP_TRACE_CACHE when one is given, and seeds the predictors with
+// "-x <seed>".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+#include "my_predictor.h"
+#include "gshare.h"
+#include "perceptron.h"
+#include "presets.h"
+#include "simulate.h"
+#include "json.h"
+
+// one trace file and what happened when it was simulated
+
+struct suite_job {
+	std::string fname;
+	unsigned long long size;	// compressed size; a stand-in for length
+	std::vector<predictor_run> runs;
+	long long int branches;
+	double seconds;
+	bool failed;
+};
+
+static void usage (char *prog) {
+	fprintf (stderr, "Usage: %s [ -j <threads> ] [ -c <cache-dir> ] [ -p <preset>[,<preset>...] ]... [ -f csv | json | text ] [ -x <seed> ] <trace-directory>\n", prog);
+	exit (1);
+}
+
+// simulate every preset on one trace
+
+static void run_job (suite_job & job, std::vector<char *> & presets, const char *cache_dir, long long int seed) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (size_t i=0; i<presets.size (); i++) {
+		job.runs.push_back (predictor_run (presets[i], make_predictor (presets[i])));
+		if (seed >= 0) job.runs.back ().p->seed (seed);
+	}
+	trace_reader *tr = open_trace (job.fname.c_str (), cache_dir);
+	if (!tr) {
+		job.failed = true;
+	} else {
+		job.branches = simulate (tr, job.runs, false);
+		close_trace (tr);
+	}
+	for (size_t i=0; i<job.runs.size (); i++) {
+		delete job.runs[i].p;
+		job.runs[i].p = NULL;
+	}
+	std::chrono::duration<double> d = std::chrono::steady_clock::now () - start;
+	job.seconds = d.count ();
+}
+
+// worker threads take the next job off the (longest first) list
+
+static void worker (std::vector<suite_job> *jobs, std::atomic<size_t> *next, std::vector<char *> *presets, const char *cache_dir, long long int seed) {
+	for (;;) {
+		size_t i = next->fetch_add (1);
+		if (i >= jobs->size ()) break;
+		run_job ((*jobs)[i], *presets, cache_dir, seed);
+	}
+}
+
+// each trace represents exactly 100 million instructions
+
+static double mpki (predictor_run & r) {
+	return 1000.0 * (r.dmiss / 1e8);
+}
+
+static double target_mpki (predictor_run & r) {
+	return 1000.0 * (r.tmiss / 1e8);
+}
+
+static bool by_name (const suite_job & a, const suite_job & b) {
+	return a.fname < b.fname;
+}
+
+static bool by_size (const suite_job & a, const suite_job & b) {
+	return a.size > b.size;
+}
+
+int main (int argc, char *argv[]) {
+	std::vector<char *> presets;
+	const char *format = "csv";
+	char *dir = NULL;
+	const char *cache_dir = getenv ("CBP_TRACE_CACHE");
+	int nthreads = std::thread::hardware_concurrency ();
+	long long int seed = -1;
+
+	for (int i=1; i<argc; i++) {
+		if (strcmp (argv[i], "-p") == 0 && i+1 < argc) {
+			for (char *name = strtok (argv[++i], ","); name; name = strtok (NULL, ","))
+				presets.push_back (name);
+		} else if (strcmp (argv[i], "-j") == 0 && i+1 < argc)
+			nthreads = atoi (argv[++i]);
+		else if (strcmp (argv[i], "-c") == 0 && i+1 < argc)
+			cache_dir = argv[++i];
+		else if (strcmp (argv[i], "-f") == 0 && i+1 < argc)
+			format = argv[++i];
+		else if (strcmp (argv[i], "-x") == 0 && i+1 < argc) {
+			seed = atoll (argv[++i]);
+			if (seed < 0 || seed > 0xffffffffLL) usage (argv[0]);
+		}
+		else if (strcmp (argv[i], "-l") == 0) {
+			list_presets (stdout);
+			exit (0);
+		} else if (argv[i][0] != '-' && !dir)
+			dir = argv[i];
+		else
+			usage (argv[0]);
+	}
+	if (!dir) usage (argv[0]);
+	if (strcmp (format, "csv") && strcmp (format, "json") && strcmp (format, "text")) usage (argv[0]);
+	if (nthreads < 1) nthreads = 1;
+	if (presets.empty ()) presets.push_back ((char *) "tage");
+	for (size_t i=0; i<presets.size (); i++) {
+		branch_predictor *p = make_predictor (presets[i]);
+		if (!p) {
+			fprintf (stderr, "%s: unknown preset \"%s\"; try -l\n", argv[0], presets[i]);
+			exit (1);
+		}
+		delete p;
+	}
+
+	// find the traces, the same ones "find <dir> -name '*.trace.*'" would
+
+	std::vector<suite_job> jobs;
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it (dir, ec), end; !ec && it != end; it.increment (ec)) {
+		if (!it->is_regular_file ()) continue;
+		if (it->path ().filename ().string ().find (".trace.") == std::string::npos) continue;
+		suite_job job;
+		job.fname = it->path ().string ();
+		job.size = it->file_size ();
+		job.branches = 0;
+		job.seconds = 0;
+		job.failed = false;
+		jobs.push_back (job);
+	}
+	if (ec) {
+		fprintf (stderr, "%s: %s\n", dir, ec.message ().c_str ());
+		exit (1);
+	}
+	if (jobs.empty ()) {
+		fprintf (stderr, "%s: no traces found\n", dir);
+		exit (1);
+	}
+
+	// longest traces first, then hand them out to the pool
+
+	std::sort (jobs.begin (), jobs.end (), by_size);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	std::atomic<size_t> next (0);
+	std::vector<std::thread> pool;
+	for (int i=0; i<nthreads && i<(int) jobs.size (); i++)
+		pool.push_back (std::thread (worker, &jobs, &next, &presets, cache_dir, seed));
+	for (size_t i=0; i<pool.size (); i++)
+		pool[i].join ();
+	std::chrono::duration<double> total = std::chrono::steady_clock::now () - start;
+
+	// report in trace name order
+
+	std::sort (jobs.begin (), jobs.end (), by_name);
+	if (strcmp (format, "csv") == 0)
+		printf ("trace,preset,branches,dmiss,mpki,tmiss,target_mpki,seconds,branches_per_sec,predictor_seconds,predictor_branches_per_sec\n");
+	else if (strcmp (format, "json") == 0)
+		printf ("[\n");
+	bool first = true;
+	int failures = 0;
+	for (size_t i=0; i<jobs.size (); i++) {
+		suite_job & job = jobs[i];
+		if (job.failed) {
+			failures++;
+			continue;
+		}
+		for (size_t j=0; j<job.runs.size (); j++) {
+			predictor_run & r = job.runs[j];
+
+			// the target misses of a preset that predicts no targets
+			// are just its taken branches, so leave them out
+
+			char tmiss[64] = "", tmpki[64] = "";
+			if (r.targets) {
+				snprintf (tmiss, sizeof (tmiss), "%lld", r.tmiss);
+				snprintf (tmpki, sizeof (tmpki), "%0.3f", target_mpki (r));
+			}
+			if (strcmp (format, "csv") == 0)
+				printf ("%s,%s,%lld,%lld,%0.3f,%s,%s,%0.3f,%0.0f,%0.3f,%0.0f\n",
+					job.fname.c_str (), r.name, job.branches, r.dmiss, mpki (r), tmiss, tmpki,
+					job.seconds, job.branches / job.seconds, r.seconds, job.branches / r.seconds);
+			else if (strcmp (format, "json") == 0) {
+				printf ("%s  { \"trace\": ", first ? "" : ",\n");
+				print_json_string (stdout, job.fname.c_str ());
+				printf (", \"preset\": ");
+				print_json_string (stdout, r.name);
+				printf (", \"branches\": %lld, \"dmiss\": %lld, "
+					"\"mpki\": %0.3f, \"tmiss\": %s, \"target_mpki\": %s, \"seconds\": %0.3f, \"branches_per_sec\": %0.0f, "
+					"\"predictor_seconds\": %0.3f, \"predictor_branches_per_sec\": %0.0f }",
+					job.branches, r.dmiss, mpki (r), r.targets ? tmiss : "null", r.targets ? tmpki : "null",
+					job.seconds, job.branches / job.seconds, r.seconds, job.branches / r.seconds);
+				first = false;
+			} else if (presets.size () == 1)
+				printf ("%-40s\t%0.3f\n", job.fname.c_str (), mpki (r));
+			else
+				printf ("%-40s\t%-16s%0.3f\n", job.fname.c_str (), r.name, mpki (r));
+		}
+	}
+	if (strcmp (format, "json") == 0)
+		printf ("\n]\n");
+
+	// averages over the traces, as the run script gave
+
+	int ok = jobs.size () - failures;
+	for (size_t j=0; j<presets.size () && ok; j++) {
+		double sum = 0;
+		for (size_t i=0; i<jobs.size (); i++)
+			if (!jobs[i].failed) sum += mpki (jobs[i].runs[j]);
+		if (strcmp (format, "text") == 0 && presets.size () == 1)
+			printf ("average MPKI: %0.3f\n", sum / ok);
+		else
+			fprintf (stderr, "%-16s average MPKI: %0.3f\n", presets[j], sum / ok);
+	}
+	fprintf (stderr, "%d traces on %d threads in %0.3f seconds\n", ok, (int) pool.size (), total.count ());
+	exit (failures ? 1 : 0);
+}
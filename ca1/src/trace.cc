@@ -9,9 +9,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bzlib.h>
+#include <zlib.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "branch.h"
 #include "trace.h"
+#include "chunked.h"
 
 // A trace is a piece of information about a branch.  The external 
 // representation of a trace is 9 bytes:
@@ -31,8 +43,10 @@
 // where the branch jumped.
 //
 // The input file is usually compressed either with gzip or bzip2 and this
-// file contains code to support reading from these formats by piping the
-// output of the decompressors.  However, this file s does another kind of
+// file contains code to support reading from these formats with zlib and
+// libbz2.  A decoder thread decompresses the file into a pair of large
+// blocks while the simulation consumes the other one, so decompression
+// overlaps simulation.  However, this file s does another kind of
 // decompression on the traces after they have been decompressed by gzip
 // or bzip2.  If the upper four bits of the first byte read are either
 // 0 or 8 then the byte indicates that the trace has been compressed
@@ -42,66 +56,56 @@
 // the purpose is to allow the stream of bytes fed to gzip or bzip2 to be
 // much more redundant and hence more compressible.
 
-// number of bytes to read at once from the decompressor
-
-#define BUFSIZE	10000
-
-// file pointer for the pipe from the decompressor
-
-FILE *tracefp;
-
-// buffer to read bytes into
-
-unsigned char buf[BUFSIZE];
-
-// current position in buffer
-unsigned int bufpos;
-
-// number of bytes read into buffer
-
-unsigned int bufsize;
-
-// true when end of file is reached
-
-bool end_of_file;
-
-// read a single byte from the trace file
-
-unsigned char read_byte (void) {
-
-	// if the buffer is empty...
+// Decoding a trace this way costs a lot more than simulating a simple
+// predictor on it, so traces can also be opened through a cache directory.
+// The first time a trace is opened that way it is decoded once into a
+// cache file holding a header and then every trace in the 9 byte external
+// representation above, uncompressed; from then on the cache file is
+// mmap()ed and read_trace just copies the fields out.  Cache files are
+// named after the CRC-32 and size of the compressed trace, so a changed
+// trace gets a new cache file.
+
+// A trace can also be in the chunked container described in chunked.h.
+// Each chunk is a bzip2-compressed pre-processed stream of its own, so
+// the decoder thread decompresses one chunk into each block and the
+// remember table and return address stack start over at every block.
+// The chunk index lets seek_trace start decoding at any chunk.
+
+// one trace as it is stored in a cache file
+
+struct cached_trace {
+	unsigned char code;
+	unsigned int address, target;
+} __attribute__ ((packed));
 
-	if (bufpos == bufsize) {
+// the header at the start of a cache file
 
-		// get a BUFSIZE-sized chunk of bytes from the input
+#define CACHE_MAGIC	"CBP2TRC"
+#define CACHE_VERSION	1
 
-		bufpos = 0;
-		bufsize = fread (buf, 1, BUFSIZE, tracefp);
+struct cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int checksum;		// CRC-32 of the compressed trace
+	unsigned long long size;	// size of the compressed trace
+	unsigned long long count;	// number of traces that follow
+};
 
-		// nothing to read?  we must be done.
+// br_flags for each value of the upper four bits of a code
 
-		if (bufsize == 0) {
-			end_of_file = true;
-			return 0;
-		}
-	}
-
-	// one more byte 
+static const unsigned int code_flags[8] = {
+	0, BR_CONDITIONAL, BR_CONDITIONAL, 0, BR_INDIRECT, BR_CALL, BR_CALL | BR_INDIRECT, BR_RETURN
+};
 
-	return buf[bufpos++];
-}
+// number of bytes the decoder thread decompresses at once, and the number
+// of such blocks in flight between it and read_trace
 
-// read an unsigned integer in little endian format from the trace file
+#define BLOCKSIZE	(1 << 20)
+#define NBLOCKS		2
 
-unsigned int read_uint (void) {
-	unsigned int x0, x1, x2, x3;
+// how the trace file is compressed
 
-	x0 = read_byte ();
-	x1 = read_byte ();
-	x2 = read_byte ();
-	x3 = read_byte ();
-	return x0 | (x1 << 8) | (x2 << 16) | (x3 << 24);
-}
+enum trace_format { PLAIN, GZIP, BZIP2, CHUNKED };
 
 // these "remember" structs and functions handle decompressing certain traces
 // using prediction.  the compression is a simple table-based predictor that
@@ -113,7 +117,6 @@ struct remember {
 	bool taken;
 	unsigned char code; 
 	unsigned int address, target;
-	unsigned int lru_time;
 
 	// constructor
 
@@ -122,7 +125,6 @@ struct remember {
 		address = 0;
 		target = 0;
 		taken = 0;
-		lru_time = 0;
 	}
 
 	// return true if two remember structs are equivalent.  optionally
@@ -138,95 +140,465 @@ struct remember {
 	}
 };
 
-// a return address stack
+// size of the return address stack
                                                                                 
 #define RAS_SIZE        100
-                                                                                
-unsigned int ras[RAS_SIZE];
-int ras_top = RAS_SIZE;
+
+// parameters for the predictor table
+
+#define N_REMEMBER	(1<<16)
+#define ASSOC		8
+
+// the predictor table is kept as separate arrays of the fields of its
+// ways.  the codes, taken bits and LRU order of a set pack into 16 bytes,
+// and the LRU order is a list of way numbers in nibbles rather than a
+// time stamp per way, so finding the way to replace doesn't search the
+// set.  the whole table is 5MB where it was 8MB as an array of remember
+// structs.
+
+struct remember_set {
+	unsigned char code[ASSOC];
+	unsigned char taken;	// bit i is the taken bit of way i
+	bool touched;		// written since the table was last reset
+	unsigned int order;	// ways from least (low nibble) to most recently used
+};
+
+// the LRU order of a set nobody has touched
+
+#define INITIAL_ORDER	0x76543210u
+
+// everything needed to decode one trace file.  each open trace has its
+// own, so several traces can be decoded at once.
+
+struct trace_reader {
+
+	// the name of the trace file, for error messages
+
+	const char *fname;
+
+	// a cache file being replayed: the mapping, the traces in it, how
+	// many there are and the index of the next one.  records is NULL
+	// when the trace is being decoded.
+
+	void *map;
+	size_t maplen;
+	const cached_trace *records;
+	unsigned long long count, next;
+
+	// the compressed file: a stdio file for plain and bzip2 files, under
+	// libbz2 for bzip2, and a zlib file for gzip
+
+	trace_format format;
+	FILE *fp;
+	BZFILE *bzfp;
+	gzFile gzfp;
+
+	// the index of a chunked trace, the next chunk the decoder thread
+	// will decompress and the number of traces in all the chunks
+
+	std::vector<chunk_entry> chunks;
+	size_t next_chunk;
+	unsigned long long ntraces;
+	std::vector<char> packed;	// a compressed chunk, read from the file
+
+	// blocks of decompressed bytes, blockbytes each.  the decoder thread
+	// fills them in order and read_byte drains them in the same order;
+	// nfull of them, starting at block 'consume', are ready to be read
+
+	unsigned char *blocks[NBLOCKS];
+	unsigned int blockbytes;
+	unsigned int blocksize[NBLOCKS];
+	int consume, nfull;
+	bool decoded_all;		// the decoder thread has reached the end
+	bool failed;			// ... and it was because of an error, not the end of the file
+	bool stop;			// close_trace wants the decoder thread gone
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread decoder;
+
+	// the block being read, current position in it and its size
+
+	unsigned char *buf;
+	unsigned int bufpos;
+	unsigned int bufsize;
+
+	// true when end of file is reached
+
+	bool end_of_file;
+
+	// number of traces decoded so far
+
+	unsigned long long position;
+
+	// a return address stack
+
+	unsigned int ras[RAS_SIZE];
+	int ras_top;
+
+	// the predictor table; a 64k-entry 8-way set associative memory.
+	// a hash table with probing would probably be more space-efficient
+	// but I think this is a little faster (neither has good locality).
+	// we can only remember up to 8 possible predictions per branch target
+	// because we're squeezing set indices into a 3-bit code so having
+	// a fixed set size is OK.  in practice, most branches need only 1 or 2
+	// possible predictions, but some traces benefit from higher associativity.
+
+	remember_set sets[N_REMEMBER];
+	unsigned int targets[N_REMEMBER][ASSOC];
+	unsigned int addresses[N_REMEMBER][ASSOC];
+
+	// the sets written since the table was last reset
+
+	std::vector<unsigned int> dirty;
+
+	// number of updates to the table so far
+
+	unsigned int now;
+
+	// target of the last trace seen
+
+	unsigned int last_target;
+
+	// the trace returned by read_trace
+
+	trace t;
+};
+
+// decompress up to n bytes of the trace file into p; returns the number
+// of bytes, 0 at the end of the file or on an error, setting tr->failed
+// on an error
+
+static unsigned int decompress (trace_reader *tr, unsigned char *p, unsigned int n) {
+	unsigned int got = 0;
+	int err;
+
+	switch (tr->format) {
+	case PLAIN:
+		got = fread (p, 1, n, tr->fp);
+		if (got < n && ferror (tr->fp)) {
+			perror (tr->fname);
+			tr->failed = true;
+		}
+		return got;
+	case GZIP:
+
+		// zlib carries on through concatenated gzip members by itself
+
+		got = gzread (tr->gzfp, p, n);
+		if ((int) got <= 0) {
+
+			// a truncated file is only noticed here
+
+			const char *msg = gzerror (tr->gzfp, &err);
+			if (err != Z_OK) {
+				fprintf (stderr, "%s\n", msg);
+				tr->failed = true;
+			}
+			return 0;
+		}
+		return got;
+	case BZIP2:
+		while (got < n && tr->bzfp) {
+			int m = BZ2_bzRead (&err, tr->bzfp, p + got, n - got);
+			if (err != BZ_OK && err != BZ_STREAM_END) {
+				fprintf (stderr, "%s: bzip2 error %d\n", tr->fname, err);
+				BZ2_bzReadClose (&err, tr->bzfp);
+				tr->bzfp = NULL;
+				tr->failed = true;
+				break;
+			}
+			got += m;
+			if (err == BZ_STREAM_END) {
+
+				// like bzip2 -d, go on to the next stream if
+				// streams were concatenated
+
+				void *unused;
+				int nunused;
+				char rest[BZ_MAX_UNUSED];
+				BZ2_bzReadGetUnused (&err, tr->bzfp, &unused, &nunused);
+				memcpy (rest, unused, nunused);
+				BZ2_bzReadClose (&err, tr->bzfp);
+				tr->bzfp = NULL;
+				if (nunused == 0) {
+					int c = getc (tr->fp);
+					if (c == EOF) break;
+					ungetc (c, tr->fp);
+				}
+				tr->bzfp = BZ2_bzReadOpen (&err, tr->fp, 0, 0, rest, nunused);
+				if (err != BZ_OK) {
+					fprintf (stderr, "%s: bzip2 error %d\n", tr->fname, err);
+					BZ2_bzReadClose (&err, tr->bzfp);
+					tr->bzfp = NULL;
+					tr->failed = true;
+				}
+			}
+		}
+		return got;
+	case CHUNKED:
+
+		// a whole chunk at a time
+
+		if (tr->next_chunk == tr->chunks.size ()) return 0;
+		{
+			chunk_entry & e = tr->chunks[tr->next_chunk++];
+			tr->packed.resize (e.packed);
+			if (fseek (tr->fp, e.offset, SEEK_SET) != 0
+			 || fread (&tr->packed[0], 1, e.packed, tr->fp) != e.packed) {
+				fprintf (stderr, "%s: truncated chunk at %llu\n", tr->fname, e.offset);
+				tr->failed = true;
+				return 0;
+			}
+			got = n;
+			err = BZ2_bzBuffToBuffDecompress ((char *) p, &got, &tr->packed[0], e.packed, 0, 0);
+			if (err != BZ_OK || got != e.raw) {
+				fprintf (stderr, "%s: bad chunk at %llu\n", tr->fname, e.offset);
+				tr->failed = true;
+				return 0;
+			}
+		}
+		return got;
+	}
+	return 0;
+}
+
+// the decoder thread: keep the blocks full until the end of the file
+
+static void decoder_thread (trace_reader *tr) {
+	int produce = 0;
+	for (;;) {
+
+		// wait for a free block
+
+		{
+			std::unique_lock<std::mutex> l (tr->lock);
+			while (tr->nfull == NBLOCKS && !tr->stop)
+				tr->changed.wait (l);
+			if (tr->stop) return;
+		}
+
+		// decompress into it without holding the lock
+
+		unsigned int n = decompress (tr, tr->blocks[produce], tr->blockbytes);
+
+		// hand it over; an empty block means the end of the file
+
+		std::unique_lock<std::mutex> l (tr->lock);
+		if (n == 0) {
+			tr->decoded_all = true;
+		} else {
+			tr->blocksize[produce] = n;
+			tr->nfull++;
+			produce = (produce + 1) % NBLOCKS;
+		}
+		tr->changed.notify_all ();
+		if (tr->decoded_all) return;
+	}
+}
+
+// get the next decompressed block from the decoder thread; false at the
+// end of the file
+
+static bool next_block (trace_reader *tr) {
+	std::unique_lock<std::mutex> l (tr->lock);
+
+	// give back the block we just finished
+
+	if (tr->buf) {
+		tr->consume = (tr->consume + 1) % NBLOCKS;
+		tr->nfull--;
+		tr->changed.notify_all ();
+	}
+	while (tr->nfull == 0 && !tr->decoded_all)
+		tr->changed.wait (l);
+	if (tr->nfull == 0) {
+		tr->buf = NULL;
+		return false;
+	}
+	tr->buf = tr->blocks[tr->consume];
+	tr->bufsize = tr->blocksize[tr->consume];
+	tr->bufpos = 0;
+	return true;
+}
+
+static void reset_remember (trace_reader *);
+
+// read a single byte from the trace file
+
+static unsigned char read_byte (trace_reader *tr) {
+
+	// if the buffer is empty...
+
+	if (tr->bufpos == tr->bufsize) {
+
+		// get the next block of bytes from the decoder thread
+
+		// nothing to read?  we must be done.
+
+		if (!next_block (tr)) {
+			tr->bufpos = tr->bufsize = 0;
+			tr->end_of_file = true;
+			return 0;
+		}
+
+		// every block of a chunked trace is a chunk, which was
+		// compressed from scratch
+
+		if (tr->format == CHUNKED) reset_remember (tr);
+	}
+
+	// one more byte 
+
+	return tr->buf[tr->bufpos++];
+}
+
+// read an unsigned integer in little endian format from the trace file
+
+static unsigned int read_uint (trace_reader *tr) {
+	unsigned int x0, x1, x2, x3;
+
+	x0 = read_byte (tr);
+	x1 = read_byte (tr);
+	x2 = read_byte (tr);
+	x3 = read_byte (tr);
+	return x0 | (x1 << 8) | (x2 << 16) | (x3 << 24);
+}
 
 // (re)initialize the return address stack
-void init_ras (void) {
-	ras_top = RAS_SIZE;
+
+static void init_ras (trace_reader *tr) {
+	tr->ras_top = RAS_SIZE;
 }
 
 // push a target onto the return address stack
 
-void push_ras (unsigned int a) {
-	if (ras_top) ras[--ras_top] = a;
+static void push_ras (trace_reader *tr, unsigned int a) {
+	if (tr->ras_top) tr->ras[--tr->ras_top] = a;
 }
 
 // pop a target from the return address stack
 
-unsigned int pop_ras (void) {
-	if (ras_top < RAS_SIZE) return ras[ras_top++];
+static unsigned int pop_ras (trace_reader *tr) {
+	if (tr->ras_top < RAS_SIZE) return tr->ras[tr->ras_top++];
 	return 0;
 }
 
-// parameters for the predictor table
+// (re)initialize the predictor table
 
-#define N_REMEMBER	(1<<16)
-#define ASSOC		8
+static void init_remember (trace_reader *tr) {
+	memset (tr->sets, 0, sizeof (tr->sets));
+	memset (tr->targets, 0, sizeof (tr->targets));
+	memset (tr->addresses, 0, sizeof (tr->addresses));
+	for (int i=0; i<N_REMEMBER; i++) tr->sets[i].order = INITIAL_ORDER;
+	tr->dirty.clear ();
+	tr->last_target = 0;
+	tr->now = 0;
+}
 
-// the predictor table; a 64k-entry 8-way set associative memory.
-// a hash table with probing would probably be more space-efficient
-// but I think this is a little faster (neither has good locality).
-// we can only remember up to 8 possible predictions per branch target
-// because we're squeezing set indices into a 3-bit code so having
-// a fixed set size is OK.  in practice, most branches need only 1 or 2
-// possible predictions, but some traces benefit from higher associativity.
+// put the predictor table and return address stack back the way
+// init_remember and init_ras left them, clearing only the sets that
+// have been written since
+
+static void reset_remember (trace_reader *tr) {
+	for (size_t i=0; i<tr->dirty.size (); i++) {
+		unsigned int set = tr->dirty[i];
+		memset (&tr->sets[set], 0, sizeof (remember_set));
+		tr->sets[set].order = INITIAL_ORDER;
+		memset (tr->targets[set], 0, sizeof (tr->targets[set]));
+		memset (tr->addresses[set], 0, sizeof (tr->addresses[set]));
+	}
+	tr->dirty.clear ();
+	tr->last_target = 0;
+	tr->now = 0;
+	init_ras (tr);
+}
 
-remember rtab[N_REMEMBER][ASSOC];
+// predict a trace; returns the set holding the predictions
 
-// this int keeps time for the LRU algorithm
+static unsigned int predict_remember (trace_reader *tr) {
+	return tr->last_target & (N_REMEMBER-1);
+}
+
+// read way i of set into r
 
-static unsigned int now = 0; 
+static void read_remember (trace_reader *tr, unsigned int set, int i, remember & r) {
+	remember_set & s = tr->sets[set];
+	r.code = s.code[i];
+	r.taken = (s.taken >> i) & 1;
+	r.address = tr->addresses[set][i];
+	r.target = tr->targets[set][i];
+}
 
-// last trace seen
+// move way i to the most recently used end of an LRU order
 
-static remember last_one; 
+static inline unsigned int touch_order (unsigned int order, int i) {
 
-// predict a trace
+	// find the nibble holding i; exactly one does, and the lowest bit
+	// this sets is in that nibble
 
-remember *predict_remember (void) {
-	unsigned int index = last_one.target & (N_REMEMBER-1);
-	remember *r = &rtab[index][0];
-	return r;
+	unsigned int x = order ^ (i * 0x11111111u);
+	int pos = __builtin_ctz ((x - 0x11111111u) & ~x & 0x88888888u) >> 2;
+
+	// close up the gap and put i on top
+
+	unsigned long long o = order;
+	unsigned long long below = o & ((1ull << (4 * pos)) - 1);
+	unsigned long long above = (o >> (4 * pos + 4)) << (4 * pos);
+	return below | above | ((unsigned long long) i << 28);
 }
 
 // update the predictor
 
-void update_remember (remember & me, remember *r, bool correct, int index) {
-	if (correct) {
-		r[index].lru_time = now++;
-	} else {
+static void update_remember (trace_reader *tr, remember & me, unsigned int set, bool correct, int index) {
+	remember_set & s = tr->sets[set];
+	if (!correct) {
 		// throw out the LRU item and replace it with me
-		int lru = 0;
-		for (int i=1; i<ASSOC; i++)
-			if (r[i].lru_time < r[lru].lru_time) lru = i;
-		r[lru] = me;
-		r[lru].lru_time = now++;
+		if (!s.touched) {
+			s.touched = true;
+			tr->dirty.push_back (set);
+		}
+		index = s.order & 15;
+		s.code[index] = me.code;
+		s.taken = (s.taken & ~(1 << index)) | (me.taken << index);
+		tr->addresses[set][index] = me.address;
+		tr->targets[set][index] = me.target;
 	}
-	last_one = me;
+
+	// the original table stamped each use with the time, starting at
+	// 0, and evicted the lowest stamp.  the very first use is stamped 0
+	// like the empty ways, so it doesn't move in the order.
+
+	if (tr->now++ && (s.order >> 28) != (unsigned int) index)
+		s.order = touch_order (s.order, index);
+	tr->last_target = me.target;
 }
 
-// read a single trace from the file
+// replaying a cache file is just a matter of copying out fields
+
+static inline void copy_cached (const cached_trace *c, trace & t) {
+	t.bi.address = c->address;
+	t.target = c->target;
+	t.bi.opcode = c->code & 15;
+	t.bi.br_flags = code_flags[(c->code >> 4) & 7];
+	t.taken = (c->code >> 4) != 2;
+}
 
-trace *read_trace (void) {
-	static trace t;
+// decode a single trace from the file into t; false at end of file
+
+static inline bool decode_trace (trace_reader *tr, trace & t) {
 	bool ras_correct, ras_offby2, ras_offby3, correct;
 
 	// read the next byte; it will either be a code, a set index for
 	// a correct prediction, or a prefix for patching a return address 
 	// prediction.
 
-	unsigned char c = read_byte ();
-	if (end_of_file) return NULL;
+	unsigned char c = read_byte (tr);
+	if (tr->end_of_file) return false;
 	remember r;
 
 	// predict the next trace
 
-	remember *p = predict_remember ();
+	unsigned int p = predict_remember (tr);
 
 	// assume return address prediction is correct
 
@@ -256,7 +628,7 @@ trace *read_trace (void) {
 		// read the next byte; it should be the set index for
 		// a correct return address prediction
 
-		c = read_byte ();
+		c = read_byte (tr);
 	}
 
 	// the byte is a correct prediction if it is less than 8;
@@ -277,7 +649,7 @@ trace *read_trace (void) {
 		// at this point we have the predicted set in p
 		// and the index into the predicted set in c.
 
-		r = p[c];
+		read_remember (tr, p, c, r);
 
 		// if this is a trace for a return...
 
@@ -285,7 +657,7 @@ trace *read_trace (void) {
 
 			// pop the return address stack
 
-			unsigned int popd = pop_ras();
+			unsigned int popd = pop_ras (tr);
 
 			// if the return address stack prediction was
 			// correct...
@@ -305,7 +677,7 @@ trace *read_trace (void) {
 				// but an incorrect return address prediction;
 				// flush the return address stack
 
-				init_ras();
+				init_ras (tr);
 		}
 
 		// set the rest of the fields from the prediction
@@ -316,7 +688,7 @@ trace *read_trace (void) {
 
 		// update the predictor
 
-		update_remember (r, p, true, (int) c);
+		update_remember (tr, r, p, true, (int) c);
 
 		// get the code into c for later use
 
@@ -330,11 +702,11 @@ trace *read_trace (void) {
 
 		// read the branch address
 
-		t.bi.address = read_uint ();
+		t.bi.address = read_uint (tr);
 
 		// read the branch target
 
-		t.target = read_uint ();
+		t.target = read_uint (tr);
 
 		// assume the branch is taken; fix later
 
@@ -352,7 +724,7 @@ trace *read_trace (void) {
 
 			// pop the return address stack
 
-			unsigned int popd = pop_ras ();
+			unsigned int popd = pop_ras (tr);
 
 			// if we have a mispredicted return address,
 			// flush the return address stack.  why are we
@@ -364,12 +736,12 @@ trace *read_trace (void) {
 
 			if (popd != t.target
 			 && popd != t.target - 2
-			 && popd != t.target + 3) init_ras();
+			 && popd != t.target + 3) init_ras (tr);
 		}
 
 		// update the predictor
 
-		update_remember (r, p, false, -1);
+		update_remember (tr, r, p, false, -1);
 	}
 
 	// get the conditional branch opcode, if any
@@ -398,11 +770,11 @@ trace *read_trace (void) {
 		break;
 	case 5: // call
 		t.bi.br_flags |= BR_CALL;
-		push_ras (t.bi.address + 5);
+		push_ras (tr, t.bi.address + 5);
 		break;
 	case 6: // indirect call
 		t.bi.br_flags |= BR_CALL | BR_INDIRECT;
-		push_ras (t.bi.address + 2);
+		push_ras (tr, t.bi.address + 2);
 		break;
 	case 7: // return
 		t.bi.br_flags |= BR_RETURN;
@@ -410,7 +782,37 @@ trace *read_trace (void) {
 	// this should "never" happen
 	default: fprintf (stderr, "%d\n", c); fflush (stderr); assert (0);
 	}
-	return & t;
+	return true;
+}
+
+// read a single trace from the file
+
+trace *read_trace (trace_reader *tr) {
+	if (tr->records) {
+		if (tr->next == tr->count) return NULL;
+		copy_cached (&tr->records[tr->next++], tr->t);
+		return & tr->t;
+	}
+	if (!decode_trace (tr, tr->t)) return NULL;
+	tr->position++;
+	return & tr->t;
+}
+
+// read up to n traces from the file into ts
+
+int read_traces (trace_reader *tr, trace *ts, int n) {
+	int i;
+	if (tr->records) {
+		if ((unsigned long long) n > tr->count - tr->next) n = tr->count - tr->next;
+		const cached_trace *c = &tr->records[tr->next];
+		for (i=0; i<n; i++) copy_cached (&c[i], ts[i]);
+		tr->next += n;
+		return n;
+	}
+	for (i=0; i<n; i++)
+		if (!decode_trace (tr, ts[i])) break;
+	tr->position += i;
+	return i;
 }
 
 // open the trace file for reading
@@ -418,44 +820,319 @@ trace *read_trace (void) {
 #define GZIP_MAGIC     "\037\213"
 #define BZIP2_MAGIC	"BZ"
 
-void init_trace (char *fname) {
-	char *dc;
-	char s[2] = { 0, 0 };
-	char cmd[1000];
+// read the index of the chunked trace in tr; false if it isn't one
+
+static bool read_chunk_index (trace_reader *tr) {
+	chunked_footer f;
+	if (fseek (tr->fp, -(long) sizeof (f), SEEK_END) != 0
+	 || fread (&f, sizeof (f), 1, tr->fp) != 1
+	 || memcmp (f.magic, CHUNKED_MAGIC, sizeof (f.magic)) != 0
+	 || f.version != CHUNKED_VERSION) return false;
+	tr->chunks.resize (f.nchunks);
+	if (f.nchunks && (fseek (tr->fp, f.index, SEEK_SET) != 0
+	 || fread (&tr->chunks[0], sizeof (chunk_entry), f.nchunks, tr->fp) != f.nchunks)) return false;
+	tr->next_chunk = 0;
+	tr->ntraces = f.ntraces;
+	tr->blockbytes = f.max_raw ? f.max_raw : 1;
+	return true;
+}
+
+// (re)start the decoder thread with nothing decompressed yet
+
+static void start_decoder (trace_reader *tr) {
+	tr->consume = 0;
+	tr->nfull = 0;
+	tr->decoded_all = false;
+	tr->failed = false;
+	tr->stop = false;
+	tr->buf = NULL;
+	tr->bufpos = 0;
+	tr->bufsize = 0;
+	tr->end_of_file = false;
+	tr->decoder = std::thread (decoder_thread, tr);
+}
+
+// stop the decoder thread if it hasn't reached the end
+
+static void stop_decoder (trace_reader *tr) {
+	{
+		std::unique_lock<std::mutex> l (tr->lock);
+		tr->stop = true;
+		tr->changed.notify_all ();
+	}
+	tr->decoder.join ();
+}
+
+static trace_reader *open_compressed_trace (const char *fname) {
+	char s[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	int err;
 
 	// figure out the compression method from the magic number
 
-	FILE *f = fopen (fname, "r");
+	FILE *f = fopen (fname, "rb");
 	if (!f) {
 		perror (fname);
+		return NULL;
 	}
-	fread (s, 1, 2, f);
-	fclose (f);
-	if (strncmp (s, GZIP_MAGIC, 2) == 0) 
-		dc = ZCAT;
-	else if (strncmp (s, BZIP2_MAGIC, 2) == 0)
-		dc = BZCAT;
+	fread (s, 1, sizeof (s), f);
+	rewind (f);
+
+	trace_reader *tr = new trace_reader;
+	tr->fname = fname;
+	tr->map = NULL;
+	tr->records = NULL;
+	tr->fp = f;
+	tr->bzfp = NULL;
+	tr->gzfp = NULL;
+	tr->blockbytes = BLOCKSIZE;
+	if (memcmp (s, CHUNKED_MAGIC, sizeof (s)) == 0) {
+		tr->format = CHUNKED;
+		err = read_chunk_index (tr) ? BZ_OK : BZ_DATA_ERROR;
+	} else if (strncmp (s, GZIP_MAGIC, 2) == 0) {
+		tr->format = GZIP;
+		fclose (f);
+		tr->fp = NULL;
+		tr->gzfp = gzopen (fname, "rb");
+		if (tr->gzfp) gzbuffer (tr->gzfp, BLOCKSIZE);
+		err = tr->gzfp ? BZ_OK : BZ_IO_ERROR;
+	} else if (strncmp (s, BZIP2_MAGIC, 2) == 0) {
+		tr->format = BZIP2;
+		tr->bzfp = BZ2_bzReadOpen (&err, f, 0, 0, NULL, 0);
+	} else {
+		tr->format = PLAIN;
+		err = BZ_OK;
+	}
+	if (err != BZ_OK) {
+		fprintf (stderr, "%s: can't start decompressing\n", fname);
+		if (tr->bzfp) BZ2_bzReadClose (&err, tr->bzfp);
+		if (tr->fp) fclose (tr->fp);
+		delete tr;
+		return NULL;
+	}
+
+	for (int i=0; i<NBLOCKS; i++) tr->blocks[i] = new unsigned char[tr->blockbytes];
+	tr->position = 0;
+	tr->ras_top = RAS_SIZE;
+	init_remember (tr);
+
+	// start decompressing ahead of the simulation
+
+	start_decoder (tr);
+	return tr;
+}
+
+// the code byte of the external representation of trace t
+
+static unsigned char trace_code (trace *t) {
+	unsigned char c;
+	if (t->bi.br_flags & BR_CONDITIONAL)
+		c = t->taken ? 1 : 2;
+	else if (t->bi.br_flags & BR_RETURN)
+		c = 7;
+	else if (t->bi.br_flags & BR_CALL)
+		c = (t->bi.br_flags & BR_INDIRECT) ? 6 : 5;
+	else if (t->bi.br_flags & BR_INDIRECT)
+		c = 4;
 	else
-		dc = CAT;
+		c = 3;
+	return (c << 4) | t->bi.opcode;
+}
 
-	// make a command that will decompress the file to stdout
+// decode the trace in fname into the cache file cname; false on failure.
+// the cache file is written under a temporary name and renamed when it
+// is complete, so a reader never sees half of one.
 
-	sprintf (cmd, "%s %s", dc, fname);
+static bool fill_cache (const char *fname, const char *cname, cache_header & h) {
+	std::string tmp = std::string (cname) + "." + std::to_string (getpid ()) + ".tmp";
+	FILE *f = fopen (tmp.c_str (), "wb");
+	if (!f) {
+		perror (tmp.c_str ());
+		return false;
+	}
+	trace_reader *tr = open_compressed_trace (fname);
+	if (!tr) {
+		fclose (f);
+		unlink (tmp.c_str ());
+		return false;
+	}
+	bool ok = fwrite (&h, sizeof (h), 1, f) == 1;
+	static const int N = 1 << 16;
+	trace *in = new trace[N];
+	cached_trace *out = new cached_trace[N];
+	int n;
+	while (ok && (n = read_traces (tr, in, N)) > 0) {
+		for (int i=0; i<n; i++) {
+			out[i].code = trace_code (&in[i]);
+			out[i].address = in[i].bi.address;
+			out[i].target = in[i].target;
+		}
+		ok = fwrite (out, sizeof (cached_trace), n, f) == (size_t) n;
+		h.count += n;
+	}
+	delete[] in;
+	delete[] out;
 
-	// pipe that stdout to tracefp
+	// a decode error also ends read_traces, but what came before it
+	// is not the whole trace and must not be cached as though it were.
+	// the decoder thread sets failed before it says it is done, so it
+	// is settled by the time read_traces has seen the end
 
-	tracefp = popen (cmd, "r");
-	if (!tracefp) {
+	bool decoded = !tr->failed;
+	close_trace (tr);
+
+	// now that the count is known, write the header for real
+
+	if (ok && decoded) {
+		rewind (f);
+		ok = fwrite (&h, sizeof (h), 1, f) == 1;
+	}
+	ok = fclose (f) == 0 && ok;
+	if (!ok) perror (tmp.c_str ());
+	if (!ok || !decoded || rename (tmp.c_str (), cname) != 0) {
+		if (ok && decoded) perror (cname);
+		unlink (tmp.c_str ());
+		return false;
+	}
+	return true;
+}
+
+// map the cache file cname into tr if it is the cache file described by
+// h; false if it isn't or can't be
+
+static bool map_cache (trace_reader *tr, const char *cname, cache_header & h) {
+	int fd = open (cname, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	cache_header *m;
+	void *map = MAP_FAILED;
+	if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (cache_header))
+		map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) return false;
+	m = (cache_header *) map;
+	if (memcmp (m->magic, h.magic, sizeof (h.magic)) != 0
+	 || m->version != h.version
+	 || m->checksum != h.checksum
+	 || m->size != h.size
+	 || sizeof (cache_header) + m->count * sizeof (cached_trace) != (size_t) st.st_size) {
+		munmap (map, st.st_size);
+		return false;
+	}
+	madvise (map, st.st_size, MADV_SEQUENTIAL);
+	tr->map = map;
+	tr->maplen = st.st_size;
+	tr->records = (const cached_trace *) (m + 1);
+	tr->count = m->count;
+	tr->next = 0;
+	return true;
+}
+
+// open a trace file, through the cache in cache_dir if there is one
+
+trace_reader *open_trace (const char *fname, const char *cache_dir) {
+	if (!cache_dir) return open_compressed_trace (fname);
+
+	// the cache key: CRC-32 and size of the compressed trace
+
+	FILE *f = fopen (fname, "rb");
+	if (!f) {
 		perror (fname);
-		exit (1);
+		return NULL;
+	}
+	cache_header h;
+	memset (&h, 0, sizeof (h));
+	strcpy (h.magic, CACHE_MAGIC);
+	h.version = CACHE_VERSION;
+	uLong crc = crc32 (0L, Z_NULL, 0);
+	unsigned char *chunk = new unsigned char[BLOCKSIZE];
+	size_t n;
+	while ((n = fread (chunk, 1, BLOCKSIZE, f)) > 0) {
+		crc = crc32 (crc, chunk, n);
+		h.size += n;
+	}
+	delete[] chunk;
+	fclose (f);
+	h.checksum = crc;
+
+	char cname[4096];
+	snprintf (cname, sizeof (cname), "%s/%08x-%llx.trc", cache_dir, h.checksum, h.size);
+	trace_reader *tr = new trace_reader;
+	tr->fname = fname;
+	tr->fp = NULL;
+	tr->bzfp = NULL;
+	tr->gzfp = NULL;
+	tr->end_of_file = false;
+	tr->failed = false;
+
+	// first time through: decode the trace into the cache
+
+	if (!map_cache (tr, cname, h)) {
+		mkdir (cache_dir, 0777);
+		if (!fill_cache (fname, cname, h) || !map_cache (tr, cname, h)) {
+			fprintf (stderr, "%s: can't cache in %s; decoding instead\n", fname, cache_dir);
+			delete tr;
+			return open_compressed_trace (fname);
+		}
 	}
-	bufpos = 0;
-	bufsize = 0;
-	end_of_file = false;
+	return tr;
 }
 
 // close the trace file
 
-void end_trace (void) {
-	fclose (tracefp);
+void close_trace (trace_reader *tr) {
+	int err;
+
+	if (tr->map) {
+		munmap (tr->map, tr->maplen);
+		delete tr;
+		return;
+	}
+
+	stop_decoder (tr);
+	for (int i=0; i<NBLOCKS; i++) delete[] tr->blocks[i];
+	if (tr->bzfp) BZ2_bzReadClose (&err, tr->bzfp);
+	if (tr->gzfp) gzclose (tr->gzfp);
+	if (tr->fp) fclose (tr->fp);
+	delete tr;
+}
+
+// the number of traces in the file, if it says
+
+long long int trace_count (trace_reader *tr) {
+	if (tr->records) return tr->count;
+	if (tr->format == CHUNKED) return tr->ntraces;
+	return -1;
+}
+
+// make trace n the next one read
+
+bool seek_trace (trace_reader *tr, unsigned long long n) {
+	if (tr->records) {
+		if (n > tr->count) return false;
+		tr->next = n;
+		return true;
+	}
+
+	// a chunked trace starts over at the chunk holding trace n
+
+	if (tr->format == CHUNKED) {
+		if (n > tr->ntraces) return false;
+		size_t k = tr->chunks.size ();
+		while (k > 0 && tr->chunks[k-1].first > n) k--;
+		if (k > 0) k--;
+		stop_decoder (tr);
+		tr->next_chunk = k;
+		tr->position = k < tr->chunks.size () ? tr->chunks[k].first : 0;
+		start_decoder (tr);
+	} else if (n < tr->position)
+		return false;
+
+	// decode the rest of the way
+
+	trace skip[256];
+	while (tr->position < n) {
+		unsigned long long m = n - tr->position;
+		if (!read_traces (tr, skip, m < 256 ? (int) m : 256)) return false;
+	}
+	return true;
 }
@@ -1,13 +1,9 @@
 // trace.h
 // This file declares functions and a struct for reading trace files.
 
-// these #define the Unix commands for decompressing gzip, bzip2, and
-// plain files.  If they are somewhere else on your system, change these
-// definitions.
-
-#define ZCAT            "/bin/gzip -dc"
-#define BZCAT           "/usr/bin/bzip2 -dc"
-#define CAT             "/bin/cat"
+// trace files may be compressed with gzip or bzip2, or not at all; they
+// are decompressed in-process with zlib and libbz2.  they may also be
+// chunked traces (see chunked.h).
 
 struct trace {
 	bool	taken;
@@ -15,6 +11,39 @@ struct trace {
 	branch_info bi;
 };
 
-void init_trace (char *);
-trace *read_trace (void);
-void end_trace (void);
+// the decoder state for one open trace file.  any number of traces may
+// be open at once, e.g. one per thread.
+
+struct trace_reader;
+
+// open a trace file for reading; NULL if it can't be opened.  with a
+// cache directory, the trace is decoded into a cache file there the first
+// time and read back from that file from then on.
+
+trace_reader *open_trace (const char *, const char *cache_dir = NULL);
+
+// read the next trace; NULL at the end of the file.  the trace is
+// overwritten by the next call on the same reader.
+
+trace *read_trace (trace_reader *);
+
+// read up to n traces into ts; returns how many were read, fewer than n
+// only at the end of the file.  this is the cheaper way to read a lot of
+// traces.
+
+int read_traces (trace_reader *, trace *ts, int n);
+
+// the number of traces in a chunked or cached trace file; -1 for other
+// files, where it isn't known without reading the whole file
+
+long long int trace_count (trace_reader *);
+
+// make trace n (counting from 0) the next one read; false if n is past
+// the end.  chunked and cached traces seek directly; other traces can
+// only seek forward, by decoding the traces in between.
+
+bool seek_trace (trace_reader *, unsigned long long n);
+
+// close the trace file
+
+void close_trace (trace_reader *);
@@ -1,17 +1,57 @@
 #include "procsim.hpp"
 #include <queue>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
 #define NUM_ARCH_REGISTERS 32
 #define MAX_INST_COUNT 100000
 
+#define INST_POOL_CHUNK 4096
+
 std::ofstream debug_file;
 
+// Hands out the instruction records for the run. Records are allocated
+// a chunk at a time and go back on a free list when they retire, so the
+// pool grows to the most instructions ever in flight and the cycle loop
+// does no malloc or free once it has.
+class InstPool {
+public:
+    std::vector<proc_inst_t*> chunks_;
+    std::vector<proc_inst_t*> free_;
+
+    InstPool() {}
+
+    ~InstPool() {
+        for (auto & chunk : chunks_) {
+            delete[] chunk;
+        }
+    }
+
+    proc_inst_t* allocate() {
+        if (free_.empty()) {
+            proc_inst_t* chunk = new proc_inst_t[INST_POOL_CHUNK];
+            chunks_.push_back(chunk);
+            free_.reserve(chunks_.size() * INST_POOL_CHUNK);
+            for (int i = INST_POOL_CHUNK - 1; i >= 0; --i) {
+                free_.push_back(&chunk[i]);
+            }
+        }
+        proc_inst_t* p_inst = free_.back();
+        free_.pop_back();
+        return p_inst;
+    }
+
+    void release(proc_inst_t* p_inst) {
+        free_.push_back(p_inst);
+    }
+};
+
 class Fetch {
 public:
     std::queue<proc_inst_t*> q_;
+    InstPool* inst_pool_;
     unsigned int cycle_count_;
     int inst_count_;
     int fetch_rate_;
@@ -20,8 +60,8 @@ public:
     std::vector<int> debug_tags_;
     std::vector<int> output_tags_;
 
-    Fetch(int fetch_rate) 
-    : cycle_count_(0), inst_count_(0), fetch_rate_(fetch_rate), global_tag_(0) {
+    Fetch(int fetch_rate, InstPool* inst_pool) 
+    : inst_pool_(inst_pool), cycle_count_(0), inst_count_(0), fetch_rate_(fetch_rate), global_tag_(0) {
     };
 
     ~Fetch() {}
@@ -29,13 +69,16 @@ public:
     void tick() {
         output_tags_.clear();
         for (int i = 0; i < fetch_rate_; ++i) {
-            proc_inst_t* p_inst = new proc_inst_t;
+            proc_inst_t* p_inst = inst_pool_->allocate();
             if (read_instruction(p_inst)) {
                 p_inst->tag = global_tag_++;
                 q_.push(p_inst);
                 output_tags_.push_back(p_inst->tag);
                 inst_count_++;
-            } else break;
+            } else {
+                inst_pool_->release(p_inst);
+                break;
+            }
         }
 
         cycle_count_++;
@@ -129,7 +172,8 @@ public:
 
 class ReservationStation {
 public:
-    std::vector<ReservationStationEntry*> table;
+    // the entries, in one array; never resized, so pointers to them hold
+    std::vector<ReservationStationEntry> table;
     size_t num_entries_;
     int cycle_count_;
     int k0_, k1_, k2_;
@@ -138,20 +182,14 @@ public:
     std::vector<ReservationStationEntry*> k2_inst_to_execute_;
 
     ReservationStation(uint64_t k0, uint64_t k1, uint64_t k2)
-     : num_entries_(2*(k0+k1+k2)), cycle_count_(0), k0_(k0), k1_(k1), k2_(k2){
-        for (int i = 0; i < 2*(k0+k1+k2); ++i) {
-            table.push_back(new ReservationStationEntry());
-        }
+     : table(2*(k0+k1+k2)), num_entries_(2*(k0+k1+k2)), cycle_count_(0), k0_(k0), k1_(k1), k2_(k2){
     }
 
     ~ReservationStation() {
-        for (int i = 0; i < table.size(); ++i) {
-            delete table[i];
-        }
     }
 
     ReservationStationEntry* get_entry(int i) {
-        return table[i-1];
+        return &table[i-1];
     }
 
     ReservationStationEntry* get_first_available_entry() {
@@ -572,13 +610,14 @@ public:
     int cycle_count_;
     int inst_count_;
     int num_result_bus_;
+    InstPool* inst_pool_;
     std::vector<ReservationStationEntry*> result_buses_;
     std::vector<ReservationStationEntry*> inst_to_retire_;
     std::vector<int> debug_tags_;
     std::vector<int> output_tags_;
 
-    CommonDataBus(int num_result_bus)
-    : cycle_count_(0), inst_count_(0), num_result_bus_(num_result_bus) {
+    CommonDataBus(int num_result_bus, InstPool* inst_pool)
+    : cycle_count_(0), inst_count_(0), num_result_bus_(num_result_bus), inst_pool_(inst_pool) {
         for (int i = 0; i < num_result_bus; ++i) {
             result_buses_.push_back(nullptr);
         }
@@ -632,7 +671,7 @@ public:
             }
 
             r->busy = false;
-            delete r->inst;
+            inst_pool_->release(r->inst);
         }
     }
 
@@ -675,6 +714,8 @@ public:
 class Tomasulo {
 public:
     int cycle_count_;
+    // Instruction records for the whole run
+    InstPool inst_pool_;
     // Fetch stage
     Fetch* fetch_;
     // Dispatch stage
@@ -686,15 +727,16 @@ public:
     // State update/Writeback stage
     CommonDataBus* common_data_bus_;
 
-    InstStatus inst_status[MAX_INST_COUNT];
+    // one per instruction; at least MAX_INST_COUNT, as the report always had
+    std::vector<InstStatus> inst_status;
 
     Tomasulo(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
-     : cycle_count_(0) {
-        common_data_bus_ =new CommonDataBus(r);
+     : cycle_count_(0), inst_status(std::max<uint64_t>(MAX_INST_COUNT, trace_instruction_count())) {
+        common_data_bus_ =new CommonDataBus(r, &inst_pool_);
         execute_ =  new Execute(k0, k1, k2, common_data_bus_->num_result_bus_);
         schedule_ = new Schedule(k0, k1, k2);
         dispatch_ = new Dispatch(schedule_->reserv_station_->num_entries_);
-        fetch_ = new Fetch(f);
+        fetch_ = new Fetch(f, &inst_pool_);
      };
 
     ~Tomasulo() {
@@ -777,8 +819,8 @@ public:
     void print_inst_status() {
         printf("INST	FETCH	DISP	SCHED	EXEC	STATE\n");
 
-        for (int i = 0; i < MAX_INST_COUNT; ++i) {
-            printf("%d	%d	%d	%d	%d	%d\n", 
+        for (size_t i = 0; i < inst_status.size(); ++i) {
+            printf("%zu	%d	%d	%d	%d	%d\n", 
                 i+1, 
                 inst_status[i].fetch,
                 inst_status[i].disp,
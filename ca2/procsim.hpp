@@ -81,6 +81,7 @@ public:
 };
 
 bool read_instruction(proc_inst_t* p_inst);
+uint64_t trace_instruction_count(void);
 
 void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f);
 void run_proc(proc_stats_t* p_stats);
@@ -2,10 +2,38 @@
 #include <cinttypes>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "procsim.hpp"
 
-FILE* inFile = stdin;
+//
+// A binary trace is BINARY_TRACE_MAGIC, a uint64_t instruction count and
+// then one trace_record_t per instruction, in host byte order, so it can
+// be mapped and used as it is.  A text trace is decoded into the same
+// records when it is loaded.
+//
+#define BINARY_TRACE_MAGIC "PSIMTRC1"
+
+typedef struct {
+    uint32_t instruction_address;
+    int32_t op_code;
+    int32_t dest_reg;
+    int32_t src_reg[2];
+} trace_record_t;
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+} binary_trace_header_t;
+
+int inFile = STDIN_FILENO;
+
+const trace_record_t* trace_records = NULL;
+uint64_t trace_length = 0;
+uint64_t trace_next = 0;
 
 void print_help_and_exit(void) {
     printf("procsim [OPTIONS]\n");
@@ -15,10 +43,186 @@ void print_help_and_exit(void) {
     printf("  -f N\t\tNumber of instructions to fetch\n");
     printf("  -r R\t\tNumber of result buses\n");
     printf("  -i traces/file.trace\n");
+    printf("  -b file\tWrite the trace as a binary trace to file and exit\n");
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
 
+//
+// parse_hex, parse_dec
+//
+//  parse one number the way fscanf's %x and %d would, skipping leading
+//  white space; return false if there is none at p
+//
+static bool parse_hex(const char*& p, const char* end, uint32_t* value)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && isxdigit((unsigned char) p[2])) p += 2;
+
+    uint32_t v = 0;
+    const char* start = p;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c >= '0' && c <= '9') v = v << 4 | (c - '0');
+        else if (c >= 'a' && c <= 'f') v = v << 4 | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v = v << 4 | (c - 'A' + 10);
+        else break;
+    }
+    *value = v;
+    return p != start;
+}
+
+static bool parse_dec(const char*& p, const char* end, int32_t* value)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint32_t v = 0;
+    const char* start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) v = v * 10 + (*p - '0');
+    *value = negative ? -v : v;
+    return p != start;
+}
+
+//
+// load_trace
+//
+//  maps the trace on fd (or reads it, if fd is a pipe) and leaves its
+//  instructions in trace_records: a binary trace is used in place, a
+//  text trace is parsed once into a contiguous array.  Like the fscanf
+//  loop this replaces, parsing stops at the first malformed line.
+//
+//  returns true if the trace could be read
+//
+bool load_trace(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+
+    const char* data = NULL;
+    size_t size = 0;
+    bool mapped = false;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        void* m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) return false;
+        madvise(m, size, MADV_SEQUENTIAL);
+        data = (const char*) m;
+        mapped = true;
+    } else {
+        size_t capacity = 1 << 20;
+        char* buf = (char*) malloc(capacity);
+        if (!buf) return false;
+        for (;;) {
+            ssize_t n = read(fd, buf + size, capacity - size);
+            if (n == 0) break;
+            if (n < 0) {
+                perror("read");
+                free(buf);
+                return false;
+            }
+            size += n;
+            if (size == capacity) {
+                char* bigger = (char*) realloc(buf, capacity * 2);
+                if (!bigger) {
+                    free(buf);
+                    return false;
+                }
+                buf = bigger;
+                capacity *= 2;
+            }
+        }
+        data = buf;
+    }
+
+    binary_trace_header_t header;
+    if (size >= sizeof(header) && memcmp(data, BINARY_TRACE_MAGIC, sizeof(header.magic)) == 0) {
+        memcpy(&header, data, sizeof(header));
+        if (header.count > (size - sizeof(header)) / sizeof(trace_record_t)) {
+            fprintf(stderr, "Binary trace is truncated\n");
+            if (mapped) munmap((void*) data, size);
+            else free((void*) data);
+            return false;
+        }
+        if (mapped) {
+            trace_records = (const trace_record_t*) (data + sizeof(header));
+        } else {
+            trace_record_t* records = (trace_record_t*) malloc(header.count * sizeof(trace_record_t) + 1);
+            if (!records) {
+                free((void*) data);
+                return false;
+            }
+            memcpy(records, data + sizeof(header), header.count * sizeof(trace_record_t));
+            free((void*) data);
+            trace_records = records;
+        }
+        trace_length = header.count;
+        return true;
+    }
+
+    // a line of the usual traces is 10 bytes or more, but the parser
+    // takes records with no white space at all, so grow when that is wrong
+    size_t capacity = size / 10 + 1;
+    trace_record_t* records = (trace_record_t*) malloc(capacity * sizeof(trace_record_t));
+    bool ok = records != NULL;
+    const char* p = data;
+    const char* end = data + size;
+    uint64_t n = 0;
+    for (trace_record_t r; ok; n++) {
+        if (!parse_hex(p, end, &r.instruction_address) || !parse_dec(p, end, &r.op_code) ||
+            !parse_dec(p, end, &r.dest_reg) || !parse_dec(p, end, &r.src_reg[0]) ||
+            !parse_dec(p, end, &r.src_reg[1])) {
+            break;
+        }
+        if (n == capacity) {
+            trace_record_t* bigger = (trace_record_t*) realloc(records, capacity * 2 * sizeof(trace_record_t));
+            if (!bigger) {
+                ok = false;
+                break;
+            }
+            records = bigger;
+            capacity *= 2;
+        }
+        records[n] = r;
+    }
+    if (mapped) munmap((void*) data, size);
+    else free((void*) data);
+    if (!ok) {
+        free(records);
+        return false;
+    }
+
+    trace_records = records;
+    trace_length = n;
+    return true;
+}
+
+//
+// write_binary_trace
+//
+//  writes the loaded trace to path as a binary trace
+//
+//  returns true if it was written
+//
+bool write_binary_trace(const char* path)
+{
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) return false;
+
+    binary_trace_header_t header;
+    memcpy(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic));
+    header.count = trace_length;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(trace_records, sizeof(trace_record_t), trace_length, out) == trace_length;
+    return fclose(out) == 0 && ok;
+}
+
+uint64_t trace_instruction_count(void)
+{
+    return trace_length;
+}
+
 //
 // read_instruction
 //
@@ -26,20 +230,23 @@ void print_help_and_exit(void) {
 //
 bool read_instruction(proc_inst_t* p_inst)
 {
-    int ret;
-    
     if (p_inst == NULL)
     {
         fprintf(stderr, "Fetch requires a valid pointer to populate\n");
         return false;
     }
-    
-    ret = fscanf(inFile, "%x %d %d %d %d\n", &p_inst->instruction_address,
-                 &p_inst->op_code, &p_inst->dest_reg, &p_inst->src_reg[0], &p_inst->src_reg[1]); 
-    if (ret != 5) {
+
+    if (trace_next >= trace_length) {
         return false;
     }
-    
+
+    const trace_record_t* r = &trace_records[trace_next++];
+    p_inst->instruction_address = r->instruction_address;
+    p_inst->op_code = r->op_code;
+    p_inst->dest_reg = r->dest_reg;
+    p_inst->src_reg[0] = r->src_reg[0];
+    p_inst->src_reg[1] = r->src_reg[1];
+
     return true;
 }
 
@@ -52,9 +259,10 @@ int main(int argc, char* argv[]) {
     uint64_t k1 = DEFAULT_K1;
     uint64_t k2 = DEFAULT_K2;
     uint64_t r = DEFAULT_R;
+    const char* binary_out = NULL;
 
     /* Read arguments */ 
-    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:h"))) {
+    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:b:h"))) {
         switch(opt) {
         case 'r':
             r = atoi(optarg);
@@ -72,13 +280,16 @@ int main(int argc, char* argv[]) {
             f = atoi(optarg);
             break;
         case 'i':
-            inFile = fopen(optarg, "r");
-            if (inFile == NULL)
+            inFile = open(optarg, O_RDONLY);
+            if (inFile < 0)
             {
                 fprintf(stderr, "Failed to open %s for reading\n", optarg);
                 print_help_and_exit();
             }
             break;
+        case 'b':
+            binary_out = optarg;
+            break;
         case 'h':
             /* Fall through */
         default:
@@ -87,6 +298,19 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    /* Load the trace */
+    if (!load_trace(inFile)) {
+        fprintf(stderr, "Failed to read the trace\n");
+        return 1;
+    }
+    if (binary_out) {
+        if (!write_binary_trace(binary_out)) {
+            fprintf(stderr, "Failed to write %s\n", binary_out);
+            return 1;
+        }
+        return 0;
+    }
+
     printf("Processor Settings\n");
     printf("R: %" PRIu64 "\n", r);
     printf("k0: %" PRIu64 "\n", k0);